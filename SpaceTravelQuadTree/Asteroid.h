@@ -1,34 +1,111 @@
 //////////////////////////////////////////////////////////////////////////////////////
-// User-defined constants: 
-// ROWS is the number of rows of  asteroids.
-// COLUMNS is the number of columns of asteroids.
-// FILL_PROBABILITY is the percentage probability that a particular row-column slot
+// User-defined constants:
+// ROWS is the default number of rows of asteroids.
+// COLUMNS is the default number of columns of asteroids.
+// FILL_PROBABILITY is the default percentage probability that a particular row-column slot
 // will be filled with an asteroid.
+// The app takes the actual field size from the command line or a field file, see AsteroidFieldSettings.
+// FIELD_SEED is the random seed of the field the app starts with.
+// FIELD_VOLUME_HEIGHT is the height the volume field spreads the asteroids over.
 /////////////////////////////////////////////////////////////////////////////////////
 
 #pragma once
 
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <xmmintrin.h>
+
 constexpr auto PI = 3.14159265;
 constexpr auto ROWS = 100;  // Number of rows of asteroids.;
 constexpr auto COLUMNS = 100; // Number of columns of asteroids.;
 constexpr auto FILL_PROBABILITY = 100;
+constexpr auto FIELD_SEED = 1u;
+constexpr auto FIELD_VOLUME_HEIGHT = 300.f;
+
+// Bump whenever setupAsteroidField places the same settings and seed differently, saved snapshots of older fields are ignored then
+constexpr auto ASTEROID_FIELD_GENERATOR_VERSION = 2u;
 
 constexpr auto SPHERE_VERTEX_COUNT = 288;
 constexpr auto SPHERE_SIZE = 5.0f;
 
+// The Asteroids columns start on a cache line, which is also the widest SIMD register,
+// and hold whole cache lines so that a SIMD loop may read past the last slot.
+constexpr size_t ASTEROID_COLUMN_ALIGNMENT = 64;
+
+// Size and fill of the generated asteroid field
+struct AsteroidFieldSettings
+{
+	AsteroidFieldSettings(){rows = ROWS; columns = COLUMNS; fillProbability = FILL_PROBABILITY;}
+
+	unsigned int rows, columns;
+	unsigned int fillProbability; // percentage of the rows * columns slots holding an asteroid
+};
+
+// Allocator handing out ASTEROID_COLUMN_ALIGNMENT aligned memory, so that the columns can be loaded with aligned SIMD loads
+template <typename T>
+struct AsteroidColumnAllocator
+{
+	using value_type = T;
+
+	AsteroidColumnAllocator(){}
+	template <typename U>
+	AsteroidColumnAllocator(const AsteroidColumnAllocator<U>&){}
+
+	T* allocate(const size_t n)
+	{
+		void* memory = _mm_malloc(n * sizeof(T), ASTEROID_COLUMN_ALIGNMENT);
+		if (memory == nullptr)
+		{
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>(memory);
+	}
+	void deallocate(T* memory, const size_t) { _mm_free(memory); }
+
+	template <typename U>
+	bool operator==(const AsteroidColumnAllocator<U>&) const { return true; }
+	template <typename U>
+	bool operator!=(const AsteroidColumnAllocator<U>&) const { return false; }
+};
+
+template <typename T>
+using AsteroidColumn = std::vector<T, AsteroidColumnAllocator<T>>;
+
+/**
+ * Asteroid field as SoA columns, sized at runtime.
+ * Slot i of every column describes the same asteroid, a slot with rds 0 is empty.
+ * The columns are padded with empty slots to whole cache lines.
+ */
 struct Asteroids
 {
-	Asteroids(){}; // compiler complaints 
+	Asteroids(){length = 0;}
+
+	// Make room for count empty slots, the old contents are dropped
+	void Resize(const unsigned int count)
+	{
+		length = count;
+		const size_t padding = ASTEROID_COLUMN_ALIGNMENT / sizeof(float);
+		const size_t padded = (count + padding - 1) / padding * padding;
+		x.assign(padded, 0.f); y.assign(padded, 0.f); z.assign(padded, 0.f);
+		i.assign(padded, 0.f); rds.assign(padded, 0.f);
+		r.assign(padded, 0); g.assign(padded, 0); b.assign(padded, 0);
+	}
+
+	unsigned int size() const { return length; }
+
 	// pos
-	float x[ROWS*COLUMNS];
-	float y[ROWS*COLUMNS];
-	float z[ROWS*COLUMNS];
+	AsteroidColumn<float> x;
+	AsteroidColumn<float> y;
+	AsteroidColumn<float> z;
 	// index
-	float i[ROWS*COLUMNS];
+	AsteroidColumn<float> i;
 	// radius
-	float rds[ROWS*COLUMNS];
+	AsteroidColumn<float> rds;
 	//colors
-	unsigned char r[ROWS*COLUMNS];
-	unsigned char g[ROWS*COLUMNS];
-	unsigned char b[ROWS*COLUMNS];
+	AsteroidColumn<unsigned char> r;
+	AsteroidColumn<unsigned char> g;
+	AsteroidColumn<unsigned char> b;
+
+	unsigned int length; // number of slots, the padding after them is not counted
 };
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <cmath>
+#include <xmmintrin.h>
+
+// SSE routines for testing a whole bucket of asteroid discs stored as SoA columns at once.
+// The columns have to be readable SIMD_WIDTH - 1 floats past the last item, lanes past the count are masked off.
+
+constexpr auto SIMD_WIDTH = 4;
+
+// Inward facing edge lines of a convex view frustum quadrilateral in the x/z plane,
+// a point is inside when nx * x + nz * z + d >= 0 holds for all 4 edges
+struct FrustumEdges
+{
+	float nx[4];
+	float nz[4];
+	float d[4];
+};
+
+// Precompute the normalized edge lines of the quadrilateral (x1,z1) .. (x4,z4), given in either winding
+static FrustumEdges MakeFrustumEdges(const float& x1, const float& z1, const float& x2, const float& z2,
+	const float& x3, const float& z3, const float& x4, const float& z4)
+{
+	const float xs[4] = { x1, x2, x3, x4 };
+	const float zs[4] = { z1, z2, z3, z4 };
+	
+	// twice the signed area tells the winding, the normals are flipped to face inwards
+	float area = 0.f;
+	for (int i = 0; i < 4; ++i)
+	{
+		area += xs[i] * zs[(i + 1) % 4] - xs[(i + 1) % 4] * zs[i];
+	}
+	const float winding = area >= 0.f ? 1.f : -1.f;
+	
+	FrustumEdges edges;
+	for (int i = 0; i < 4; ++i)
+	{
+		const float dx = xs[(i + 1) % 4] - xs[i];
+		const float dz = zs[(i + 1) % 4] - zs[i];
+		const float length = sqrt(dx * dx + dz * dz);
+		const float scale = length > 0.f ? winding / length : 0.f;
+		
+		edges.nx[i] = -dz * scale;
+		edges.nz[i] = dx * scale;
+		edges.d[i] = -(edges.nx[i] * xs[i] + edges.nz[i] * zs[i]);
+	}
+	return edges;
+}
+
+// View frustum quadrilateral of one cull, the corners, their edge lines and bounds are computed once per query
+struct FrustumQuad
+{
+	float x[4];
+	float z[4];
+	FrustumEdges edges;
+	float minX, minZ, maxX, maxZ; // bounding box of the corners
+};
+
+static FrustumQuad MakeFrustumQuad(const float& x1, const float& z1, const float& x2, const float& z2,
+	const float& x3, const float& z3, const float& x4, const float& z4)
+{
+	FrustumQuad quad = { { x1, x2, x3, x4 }, { z1, z2, z3, z4 }, MakeFrustumEdges(x1, z1, x2, z2, x3, z3, x4, z4),
+		std::fmin(std::fmin(x1, x2), std::fmin(x3, x4)), std::fmin(std::fmin(z1, z2), std::fmin(z3, z4)),
+		std::fmax(std::fmax(x1, x2), std::fmax(x3, x4)), std::fmax(std::fmax(z1, z2), std::fmax(z3, z4)) };
+	return quad;
+}
+
+// Where an axis aligned box lies relative to a view frustum
+enum class FrustumOverlap
+{
+	Outside,
+	Intersecting,
+	Inside // the whole box is in the frustum
+};
+
+/**
+ * Separating axis test of the box [minX, maxX] x [minZ, maxZ] against the frustum quadrilateral.
+ * The axes of two convex polygons are the only candidates, so x, z and the 4 edge normals decide it exactly.
+ * Along an edge normal only the box corner furthest out and the one furthest in matter, the distance of
+ * the box centre plus or minus the half extents projected on the normal.
+ */
+static FrustumOverlap ClassifyBoxInFrustum(const FrustumQuad& frustum, const float minX, const float minZ,
+	const float maxX, const float maxZ)
+{
+	if (maxX < frustum.minX || minX > frustum.maxX || maxZ < frustum.minZ || minZ > frustum.maxZ)
+	{
+		return FrustumOverlap::Outside;
+	}
+	
+	const float centreX = (minX + maxX) * 0.5f, halfX = (maxX - minX) * 0.5f;
+	const float centreZ = (minZ + maxZ) * 0.5f, halfZ = (maxZ - minZ) * 0.5f;
+	const FrustumEdges& edges = frustum.edges;
+	bool inside = true;
+	for (int e = 0; e < 4; ++e)
+	{
+		const float distance = edges.nx[e] * centreX + edges.nz[e] * centreZ + edges.d[e];
+		const float reach = fabs(edges.nx[e]) * halfX + fabs(edges.nz[e]) * halfZ;
+		if (distance + reach < 0.f)
+		{
+			return FrustumOverlap::Outside;
+		}
+		inside = inside && distance - reach >= 0.f;
+	}
+	return inside ? FrustumOverlap::Inside : FrustumOverlap::Intersecting;
+}
+
+// 4 axis aligned boxes as SoA, lane i of every register holds box i
+struct BoxLanes
+{
+	__m128 minX, minZ, maxX, maxZ;
+};
+
+/**
+ * ClassifyBoxInFrustum for the 4 boxes at once
+ * @param inside OUT bit i is set if box i lies entirely in the frustum
+ * @return bit i is set unless box i is outside the frustum
+ */
+static int ClassifyBoxesInFrustum(const FrustumQuad& frustum, const BoxLanes& boxes, int& inside /*OUT*/)
+{
+	__m128 overlap = _mm_and_ps(
+		_mm_and_ps(_mm_cmpge_ps(boxes.maxX, _mm_set1_ps(frustum.minX)), _mm_cmple_ps(boxes.minX, _mm_set1_ps(frustum.maxX))),
+		_mm_and_ps(_mm_cmpge_ps(boxes.maxZ, _mm_set1_ps(frustum.minZ)), _mm_cmple_ps(boxes.minZ, _mm_set1_ps(frustum.maxZ))));
+	
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 centreX = _mm_mul_ps(_mm_add_ps(boxes.minX, boxes.maxX), half);
+	const __m128 centreZ = _mm_mul_ps(_mm_add_ps(boxes.minZ, boxes.maxZ), half);
+	const __m128 halfX = _mm_mul_ps(_mm_sub_ps(boxes.maxX, boxes.minX), half);
+	const __m128 halfZ = _mm_mul_ps(_mm_sub_ps(boxes.maxZ, boxes.minZ), half);
+	const FrustumEdges& edges = frustum.edges;
+	__m128 contained = overlap;
+	for (int e = 0; e < 4; ++e)
+	{
+		const __m128 distance = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(centreX, _mm_set1_ps(edges.nx[e])),
+			_mm_mul_ps(centreZ, _mm_set1_ps(edges.nz[e]))),
+			_mm_set1_ps(edges.d[e]));
+		const __m128 reach = _mm_add_ps(
+			_mm_mul_ps(halfX, _mm_set1_ps(fabs(edges.nx[e]))),
+			_mm_mul_ps(halfZ, _mm_set1_ps(fabs(edges.nz[e]))));
+		overlap = _mm_and_ps(overlap, _mm_cmpge_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+		contained = _mm_and_ps(contained, _mm_cmpge_ps(_mm_sub_ps(distance, reach), _mm_setzero_ps()));
+	}
+	inside = _mm_movemask_ps(_mm_and_ps(contained, overlap));
+	return _mm_movemask_ps(overlap);
+}
+
+/**
+ * checkDiscRectangleIntersection for the 4 boxes at once, the closest point of each box is compared with r
+ * @return bit i is set if box i intersects the disc centered (px,pz) of radius r
+ */
+static int BoxesNearPoint(const BoxLanes& boxes, const float& px, const float& pz, const float& r)
+{
+	const __m128 qx = _mm_set1_ps(px);
+	const __m128 qz = _mm_set1_ps(pz);
+	const __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(boxes.minX, qx), _mm_sub_ps(qx, boxes.maxX)), _mm_setzero_ps());
+	const __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(boxes.minZ, qz), _mm_sub_ps(qz, boxes.maxZ)), _mm_setzero_ps());
+	const __m128 distance = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz));
+	return _mm_movemask_ps(_mm_cmple_ps(distance, _mm_set1_ps(r * r)));
+}
+
+// Lanes of the first count (up to 4) items
+static int LaneMask(const unsigned int count)
+{
+	return count >= SIMD_WIDTH ? 0xf : (1 << count) - 1;
+}
+
+/**
+ * Calls found(i) for every disc i in [0, count) that is not entirely outside one of the frustum edges.
+ * Conservative near the frustum corners, which is what culling needs.
+ */
+template <typename Found>
+static void ScanDiscsInFrustum(const float* x, const float* z, const float* rds, const unsigned int count,
+	const FrustumEdges& edges, Found found)
+{
+	for (unsigned int i = 0; i < count; i += SIMD_WIDTH)
+	{
+		const __m128 cx = _mm_loadu_ps(x + i);
+		const __m128 cz = _mm_loadu_ps(z + i);
+		const __m128 minusR = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(rds + i));
+		
+		__m128 inside = _mm_cmpeq_ps(cx, cx); // all lanes set
+		for (int e = 0; e < 4; ++e)
+		{
+			const __m128 distance = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(cx, _mm_set1_ps(edges.nx[e])),
+				_mm_mul_ps(cz, _mm_set1_ps(edges.nz[e]))),
+				_mm_set1_ps(edges.d[e]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, minusR));
+		}
+		
+		int mask = _mm_movemask_ps(inside) & LaneMask(count - i);
+		while (mask)
+		{
+			const int lane = mask & 1 ? 0 : mask & 2 ? 1 : mask & 4 ? 2 : 3;
+			found(i + lane);
+			mask &= mask - 1;
+		}
+	}
+}
+
+/**
+ * Calls found(i) for every disc i in [0, count) that intersects the disc centered (px,pz) of radius r
+ */
+template <typename Found>
+static void ScanDiscsNearPoint(const float* x, const float* z, const float* rds, const unsigned int count,
+	const float& px, const float& pz, const float& r, Found found)
+{
+	const __m128 qx = _mm_set1_ps(px);
+	const __m128 qz = _mm_set1_ps(pz);
+	const __m128 qr = _mm_set1_ps(r);
+	for (unsigned int i = 0; i < count; i += SIMD_WIDTH)
+	{
+		const __m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), qx);
+		const __m128 dz = _mm_sub_ps(_mm_loadu_ps(z + i), qz);
+		const __m128 reach = _mm_add_ps(_mm_loadu_ps(rds + i), qr);
+		const __m128 distance = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz));
+		
+		int mask = _mm_movemask_ps(_mm_cmple_ps(distance, _mm_mul_ps(reach, reach))) & LaneMask(count - i);
+		while (mask)
+		{
+			const int lane = mask & 1 ? 0 : mask & 2 ? 1 : mask & 4 ? 2 : 3;
+			found(i + lane);
+			mask &= mask - 1;
+		}
+	}
+}
+
+// Inward facing planes of a 3D view frustum (near, far and the 4 sides),
+// a point is inside when nx * x + ny * y + nz * z + d >= 0 holds for all 6 planes
+struct FrustumPlanes
+{
+	float nx[6];
+	float ny[6];
+	float nz[6];
+	float d[6];
+};
+
+/**
+ * Calls found(i) for every sphere i in [0, count) that is not entirely outside one of the frustum planes.
+ * Conservative near the frustum edges, which is what culling needs.
+ */
+template <typename Found>
+static void ScanSpheresInFrustum(const float* x, const float* y, const float* z, const float* rds, const unsigned int count,
+	const FrustumPlanes& planes, Found found)
+{
+	for (unsigned int i = 0; i < count; i += SIMD_WIDTH)
+	{
+		const __m128 cx = _mm_loadu_ps(x + i);
+		const __m128 cy = _mm_loadu_ps(y + i);
+		const __m128 cz = _mm_loadu_ps(z + i);
+		const __m128 minusR = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(rds + i));
+		
+		__m128 inside = _mm_cmpeq_ps(cx, cx); // all lanes set
+		for (int p = 0; p < 6; ++p)
+		{
+			const __m128 distance = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(cx, _mm_set1_ps(planes.nx[p])),
+				_mm_mul_ps(cy, _mm_set1_ps(planes.ny[p]))), _mm_add_ps(
+				_mm_mul_ps(cz, _mm_set1_ps(planes.nz[p])),
+				_mm_set1_ps(planes.d[p])));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, minusR));
+		}
+		
+		int mask = _mm_movemask_ps(inside) & LaneMask(count - i);
+		while (mask)
+		{
+			const int lane = mask & 1 ? 0 : mask & 2 ? 1 : mask & 4 ? 2 : 3;
+			found(i + lane);
+			mask &= mask - 1;
+		}
+	}
+}
+
+/**
+ * Calls found(i) for every sphere i in [0, count) that intersects the sphere centered (px,py,pz) of radius r
+ */
+template <typename Found>
+static void ScanSpheresNearPoint(const float* x, const float* y, const float* z, const float* rds, const unsigned int count,
+	const float& px, const float& py, const float& pz, const float& r, Found found)
+{
+	const __m128 qx = _mm_set1_ps(px);
+	const __m128 qy = _mm_set1_ps(py);
+	const __m128 qz = _mm_set1_ps(pz);
+	const __m128 qr = _mm_set1_ps(r);
+	for (unsigned int i = 0; i < count; i += SIMD_WIDTH)
+	{
+		const __m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), qx);
+		const __m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), qy);
+		const __m128 dz = _mm_sub_ps(_mm_loadu_ps(z + i), qz);
+		const __m128 reach = _mm_add_ps(_mm_loadu_ps(rds + i), qr);
+		const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		
+		int mask = _mm_movemask_ps(_mm_cmple_ps(distance, _mm_mul_ps(reach, reach))) & LaneMask(count - i);
+		while (mask)
+		{
+			const int lane = mask & 1 ? 0 : mask & 2 ? 1 : mask & 4 ? 2 : 3;
+			found(i + lane);
+			mask &= mask - 1;
+		}
+	}
+}
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+#include "QuadTree.h"
+
+// Bounding volume hierarchy over the asteroid discs, an alternative backend for the SpatialIndex interface.
+// Unlike the QuadTree, KdTree and grid, every node box is fitted to the discs below it, radius included,
+// so one large asteroid only grows the boxes on its own path instead of the margin of the whole structure.
+// The splits are chosen with a binned surface area heuristic, in the x/z plane the queries work in.
+
+using namespace std;
+
+constexpr auto BVH_BINS = 16; // candidate split positions per node are the borders between these bins
+constexpr auto BVH_MAX_LEAF_SIZE = 16u; // nodes with more asteroids than this are always split
+constexpr float BVH_TRAVERSAL_COST = 8.f; // cost of visiting a node in disc tests, a box test costs far more than a SIMD disc test
+
+// Node of the Bvh, 32 bytes so that two of them share a cache line
+// The two children of an inner node are stored next to each other.
+struct BvhNode
+{
+	float minX, minY, minZ; // box around the spheres of the subtree
+	float maxX, maxY, maxZ;
+	unsigned int first; // index of the first child for an inner node, of the first entry for a leaf
+	unsigned int count; // number of asteroids in a leaf, 0 for an inner node
+};
+
+static_assert(sizeof(BvhNode) == 32, "BvhNode is expected to be 32 bytes");
+
+struct Bvh
+{
+	std::vector<BvhNode> nodes; // nodes[0] is the root
+	QuadTreeEntries entries; // asteroids in tree order
+	std::vector<Location> buildAsteroids; // buffer the builder partitions, kept for its memory
+};
+
+// Box of a bin or of a split side in the x/z plane while building
+struct BvhBounds
+{
+	float minX, maxX, minZ, maxZ;
+};
+
+static BvhBounds EmptyBvhBounds()
+{
+	return { FLT_MAX, -FLT_MAX, FLT_MAX, -FLT_MAX };
+}
+
+static void GrowBvhBounds(BvhBounds& bounds, const BvhBounds& other)
+{
+	bounds.minX = glm::min(bounds.minX, other.minX);
+	bounds.maxX = glm::max(bounds.maxX, other.maxX);
+	bounds.minZ = glm::min(bounds.minZ, other.minZ);
+	bounds.maxZ = glm::max(bounds.maxZ, other.maxZ);
+}
+
+// Half the perimeter, the 2D surface area: the chance a random line crosses a box grows with it
+static float BvhHalfPerimeter(const BvhBounds& bounds)
+{
+	return (bounds.maxX - bounds.minX) + (bounds.maxZ - bounds.minZ);
+}
+
+static float BvhCentre(const Location& loc, const int axis)
+{
+	return axis == 0 ? loc.x : loc.z;
+}
+
+/**
+ * System for building the Bvh, nodes are split in the order they are stored like the KdTree builder
+ * Every node sorts the centres of its asteroids into BVH_BINS bins along its longer side and splits at the
+ * bin border with the lowest estimated query cost, or stays a leaf when that is cheaper than splitting.
+ */
+static void BvhInitializeSystem(const Asteroids& asteroids, const unsigned int length, Bvh& bvh)
+{
+	auto& buildAsteroids = bvh.buildAsteroids;
+	buildAsteroids.clear();
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		if (asteroids.rds[i] > 0.f)
+		{
+			buildAsteroids.push_back({ asteroids.x[i], asteroids.y[i], asteroids.z[i], asteroids.rds[i], i });
+		}
+	}
+	
+	// a node waiting to be split holds its range of buildAsteroids in first and count
+	auto& nodes = bvh.nodes;
+	nodes.clear();
+	nodes.push_back({ 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0u, static_cast<unsigned int>(buildAsteroids.size()) });
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		const unsigned int first = nodes[i].first, count = nodes[i].count;
+		const auto begin = buildAsteroids.begin() + first;
+		const auto end = begin + count;
+	
+		BvhNode& node = nodes[i];
+		node.minX = node.minY = node.minZ = FLT_MAX;
+		node.maxX = node.maxY = node.maxZ = -FLT_MAX;
+		BvhBounds centres = EmptyBvhBounds();
+		for (auto it = begin; it != end; ++it)
+		{
+			node.minX = glm::min(node.minX, it->x - it->rds);
+			node.minY = glm::min(node.minY, it->y - it->rds);
+			node.minZ = glm::min(node.minZ, it->z - it->rds);
+			node.maxX = glm::max(node.maxX, it->x + it->rds);
+			node.maxY = glm::max(node.maxY, it->y + it->rds);
+			node.maxZ = glm::max(node.maxZ, it->z + it->rds);
+			GrowBvhBounds(centres, { it->x, it->x, it->z, it->z });
+		}
+		if (count <= SIMD_WIDTH)
+		{
+			continue; // one SIMD scan, splitting cannot pay off
+		}
+	
+		const int axis = centres.maxX - centres.minX >= centres.maxZ - centres.minZ ? 0 : 1;
+		const float low = axis == 0 ? centres.minX : centres.minZ;
+		const float extent = (axis == 0 ? centres.maxX : centres.maxZ) - low;
+		auto middle = begin + count / 2;
+		if (extent > 0.f)
+		{
+			const float scale = BVH_BINS / extent;
+			const auto binOf = [axis, low, scale](const Location& loc)
+			{
+				return glm::min(BVH_BINS - 1, static_cast<int>((BvhCentre(loc, axis) - low) * scale));
+			};
+	
+			BvhBounds binBounds[BVH_BINS];
+			unsigned int binCount[BVH_BINS] = {};
+			fill(binBounds, binBounds + BVH_BINS, EmptyBvhBounds());
+			for (auto it = begin; it != end; ++it)
+			{
+				const int bin = binOf(*it);
+				++binCount[bin];
+				GrowBvhBounds(binBounds[bin], { it->x - it->rds, it->x + it->rds, it->z - it->rds, it->z + it->rds });
+			}
+	
+			// cost of the upper side of every split, swept from the top, then the lower side swept from the bottom
+			float upperCost[BVH_BINS];
+			BvhBounds side = EmptyBvhBounds();
+			unsigned int sideCount = 0;
+			for (int bin = BVH_BINS - 1; bin > 0; --bin)
+			{
+				GrowBvhBounds(side, binBounds[bin]);
+				sideCount += binCount[bin];
+				upperCost[bin] = sideCount > 0 ? sideCount * BvhHalfPerimeter(side) : 0.f;
+			}
+			side = EmptyBvhBounds();
+			sideCount = 0;
+			float bestCost = FLT_MAX;
+			int bestSplit = 0;
+			for (int bin = 1; bin < BVH_BINS; ++bin)
+			{
+				GrowBvhBounds(side, binBounds[bin - 1]);
+				sideCount += binCount[bin - 1];
+				const float cost = (sideCount > 0 ? sideCount * BvhHalfPerimeter(side) : 0.f) + upperCost[bin];
+				if (sideCount > 0 && sideCount < count && cost < bestCost)
+				{
+					bestCost = cost;
+					bestSplit = bin;
+				}
+			}
+	
+			const BvhBounds nodeBounds = { node.minX, node.maxX, node.minZ, node.maxZ };
+			const float nodeArea = glm::max(BvhHalfPerimeter(nodeBounds), FLT_MIN);
+			if (count <= BVH_MAX_LEAF_SIZE && BVH_TRAVERSAL_COST + bestCost / nodeArea >= count)
+			{
+				continue;
+			}
+			middle = partition(begin, end, [&binOf, bestSplit](const Location& loc){ return binOf(loc) < bestSplit; });
+		}
+		else if (count <= BVH_MAX_LEAF_SIZE)
+		{
+			continue; // all the centres coincide, no split separates them
+		}
+		else
+		{
+			nth_element(begin, middle, end, [](const Location& a, const Location& b){ return a.index < b.index; });
+		}
+	
+		const unsigned int lowerCount = static_cast<unsigned int>(middle - begin);
+		node.first = static_cast<unsigned int>(nodes.size());
+		node.count = 0;
+		nodes.push_back({ 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, first, lowerCount });
+		nodes.push_back({ 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, first + lowerCount, count - lowerCount });
+	}
+	
+	const size_t count = buildAsteroids.size();
+	auto& entries = bvh.entries;
+	entries.x.assign(count + SIMD_WIDTH - 1, 0.f);
+	entries.y.assign(count + SIMD_WIDTH - 1, 0.f);
+	entries.z.assign(count + SIMD_WIDTH - 1, 0.f);
+	entries.rds.assign(count + SIMD_WIDTH - 1, 0.f);
+	entries.index.resize(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const Location& loc = buildAsteroids[i];
+		entries.x[i] = loc.x;
+		entries.y[i] = loc.y;
+		entries.z[i] = loc.z;
+		entries.rds[i] = loc.rds;
+		entries.index[i] = loc.index;
+	}
+}
+
+/**
+ * Recursive part of GatherAsteroidSystem
+ */
+static void GatherAsteroidNodeSystem(const float& x, const float& z, const float& r, const Bvh& bvh, const unsigned int at,
+	vector<Location>& al /*OUT*/)
+{
+	const BvhNode& node = bvh.nodes[at];
+	if (!checkDiscRectangleIntersection(node.minX, node.minZ, node.maxX, node.maxZ, x, z, r))
+	{
+		return;
+	}
+	
+	if (node.count > 0)
+	{
+		const auto& entries = bvh.entries;
+		const unsigned int& first = node.first;
+		ScanDiscsNearPoint(&entries.x[first], &entries.z[first], &entries.rds[first], node.count, x, z, r,
+			[&](const unsigned int i){ al.push_back(entries.at(first + i)); });
+		return;
+	}
+	
+	GatherAsteroidNodeSystem(x, z, r, bvh, node.first, al);
+	GatherAsteroidNodeSystem(x, z, r, bvh, node.first + 1, al);
+}
+
+/**
+ * System that detects which asteroids should be considered for collision checks, see the QuadTree version
+ */
+static void GatherAsteroidSystem(const float& x, const float& z, const float& r, const Bvh& bvh, vector<Location>& al /*OUT*/)
+{
+	if (bvh.entries.size() > 0)
+	{
+		GatherAsteroidNodeSystem(x, z, r, bvh, 0, al);
+	}
+}
+
+/**
+ * Recursive part of CullAsteroidsSystem
+ */
+template<typename Found>
+static void CullAsteroidsNodeSystem(const FrustumQuad& frustum, const Bvh& bvh, const unsigned int at, Found& found)
+{
+	// the boxes already hold the whole discs, no margin is needed
+	const BvhNode& node = bvh.nodes[at];
+	if (ClassifyBoxInFrustum(frustum, node.minX, node.minZ, node.maxX, node.maxZ) == FrustumOverlap::Outside)
+	{
+		return;
+	}
+	
+	if (node.count > 0)
+	{
+		const auto& entries = bvh.entries;
+		const unsigned int& first = node.first;
+		ScanDiscsInFrustum(&entries.x[first], &entries.z[first], &entries.rds[first], node.count, frustum.edges,
+			[&](const unsigned int i){ found(entries.index[first + i]); });
+		return;
+	}
+	
+	CullAsteroidsNodeSystem(frustum, bvh, node.first, found);
+	CullAsteroidsNodeSystem(frustum, bvh, node.first + 1, found);
+}
+
+/**
+ * System for culling asteroids based on the Bvh, found(index) is called for every asteroid in the frustum
+ */
+template<typename Found>
+static void CullAsteroidsSystem(const float& x1, const float& z1, const float& x2, const float& z2,
+					  const float& x3, const float& z3, const float& x4, const float& z4, const Bvh& bvh, Found found)
+{
+	if (bvh.entries.size() > 0)
+	{
+		CullAsteroidsNodeSystem(MakeFrustumQuad(x1, z1, x2, z2, x3, z3, x4, z4), bvh, 0u, found);
+	}
+}
+
+// The Bvh fits its boxes to the asteroids, the square is not needed
+static void SpatialIndexBuildSystem(Bvh& bvh, const float, const float, const float,
+	const Asteroids& asteroids, const unsigned int length)
+{
+	BvhInitializeSystem(asteroids, length, bvh);
+}
+
+static const char* SpatialIndexName(const Bvh&) { return "bvh"; }
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+#include "QuadTree.h"
+
+// k-d tree over the asteroid centres, an alternative backend for the SpatialIndex interface.
+// Every split halves the asteroids of a node at the median of its wider side, so the tree stays balanced
+// whatever the distribution. The node boxes are not stored, the queries narrow the box of the root at every split.
+
+using namespace std;
+
+constexpr auto KDTREE_LEAF_SIZE = 16u; // nodes with more asteroids than this are split
+
+// Node of the KdTree, the two children of a split node are stored next to each other
+struct KdTreeNode
+{
+	float split; // coordinate of the splitting line, the lower child holds the centres up to it
+	int axis; // 0 splits along x, 1 along z, -1 for a leaf
+	int firstChild; // index of the lower child in KdTree::nodes, the upper one follows it
+	unsigned int firstAsteroid, asteroidCount; // the whole subtree is one range of KdTree::entries
+};
+
+struct KdTree
+{
+	KdTree(){minX = maxX = minZ = maxZ = 0.f; boundsMargin = 0.f;}
+	
+	std::vector<KdTreeNode> nodes; // nodes[0] is the root
+	QuadTreeEntries entries; // asteroids in tree order
+	std::vector<Location> buildAsteroids; // buffer the builder partitions, kept for its memory
+	float minX, maxX, minZ, maxZ; // box around all the centres, the box of the root
+	float boundsMargin; // largest radius, how far a disc may stick out of the box of its node
+};
+
+// Box of a node, narrowed down from the root box while descending
+struct KdTreeBox
+{
+	float minX, maxX, minZ, maxZ;
+};
+
+static float KdTreeCoordinate(const Location& loc, const int axis)
+{
+	return axis == 0 ? loc.x : loc.z;
+}
+
+// Boxes of the two children of a split node
+static void SplitKdTreeBox(const KdTreeNode& node, const KdTreeBox& box, KdTreeBox& lower /*OUT*/, KdTreeBox& upper /*OUT*/)
+{
+	lower = upper = box;
+	(node.axis == 0 ? lower.maxX : lower.maxZ) = node.split;
+	(node.axis == 0 ? upper.minX : upper.minZ) = node.split;
+}
+
+/**
+ * System for building the KdTree, nodes are split in the order they are stored like the QuadTree builder
+ */
+static void KdTreeInitializeSystem(const Asteroids& asteroids, const unsigned int length, KdTree& tree)
+{
+	auto& buildAsteroids = tree.buildAsteroids;
+	buildAsteroids.clear();
+	tree.boundsMargin = 0.f;
+	tree.minX = tree.minZ = FLT_MAX;
+	tree.maxX = tree.maxZ = -FLT_MAX;
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		if (asteroids.rds[i] > 0.f)
+		{
+			buildAsteroids.push_back({ asteroids.x[i], asteroids.y[i], asteroids.z[i], asteroids.rds[i], i });
+			tree.minX = glm::min(tree.minX, asteroids.x[i]);
+			tree.maxX = glm::max(tree.maxX, asteroids.x[i]);
+			tree.minZ = glm::min(tree.minZ, asteroids.z[i]);
+			tree.maxZ = glm::max(tree.maxZ, asteroids.z[i]);
+			tree.boundsMargin = glm::max(tree.boundsMargin, asteroids.rds[i]);
+		}
+	}
+	
+	auto& nodes = tree.nodes;
+	nodes.clear();
+	vector<KdTreeBox> boxes(1, { tree.minX, tree.maxX, tree.minZ, tree.maxZ });
+	nodes.push_back({ 0.f, -1, -1, 0u, static_cast<unsigned int>(buildAsteroids.size()) });
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		const KdTreeNode node = nodes[i];
+		if (node.asteroidCount <= KDTREE_LEAF_SIZE)
+		{
+			continue;
+		}
+	
+		const KdTreeBox box = boxes[i];
+		const int axis = box.maxX - box.minX >= box.maxZ - box.minZ ? 0 : 1;
+		const auto begin = buildAsteroids.begin() + node.firstAsteroid;
+		const auto middle = begin + node.asteroidCount / 2;
+		nth_element(begin, middle, begin + node.asteroidCount, [axis](const Location& a, const Location& b)
+		{
+			return KdTreeCoordinate(a, axis) < KdTreeCoordinate(b, axis);
+		});
+		nodes[i].axis = axis;
+		nodes[i].split = KdTreeCoordinate(*middle, axis);
+		nodes[i].firstChild = static_cast<int>(nodes.size());
+		
+		KdTreeBox lower, upper;
+		SplitKdTreeBox(nodes[i], box, lower, upper);
+		const unsigned int lowerCount = node.asteroidCount / 2;
+		nodes.push_back({ 0.f, -1, -1, node.firstAsteroid, lowerCount });
+		nodes.push_back({ 0.f, -1, -1, node.firstAsteroid + lowerCount, node.asteroidCount - lowerCount });
+		boxes.push_back(lower);
+		boxes.push_back(upper);
+	}
+	
+	const size_t count = buildAsteroids.size();
+	auto& entries = tree.entries;
+	entries.x.assign(count + SIMD_WIDTH - 1, 0.f);
+	entries.y.assign(count + SIMD_WIDTH - 1, 0.f);
+	entries.z.assign(count + SIMD_WIDTH - 1, 0.f);
+	entries.rds.assign(count + SIMD_WIDTH - 1, 0.f);
+	entries.index.resize(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const Location& loc = buildAsteroids[i];
+		entries.x[i] = loc.x;
+		entries.y[i] = loc.y;
+		entries.z[i] = loc.z;
+		entries.rds[i] = loc.rds;
+		entries.index[i] = loc.index;
+	}
+}
+
+/**
+ * Recursive part of GatherAsteroidSystem
+ */
+static void GatherAsteroidNodeSystem(const float& x, const float& z, const float& r, const KdTree& tree, const int at,
+	const KdTreeBox& box, vector<Location>& al /*OUT*/)
+{
+	if (!checkDiscRectangleIntersection(box.minX, box.minZ, box.maxX, box.maxZ, x, z, r + tree.boundsMargin))
+	{
+		return;
+	}
+	
+	const KdTreeNode& node = tree.nodes[at];
+	if (node.axis < 0)
+	{
+		const auto& entries = tree.entries;
+		const unsigned int& first = node.firstAsteroid;
+		ScanDiscsNearPoint(&entries.x[first], &entries.z[first], &entries.rds[first], node.asteroidCount, x, z, r,
+			[&](const unsigned int i){ al.push_back(entries.at(first + i)); });
+		return;
+	}
+	
+	KdTreeBox lower, upper;
+	SplitKdTreeBox(node, box, lower, upper);
+	GatherAsteroidNodeSystem(x, z, r, tree, node.firstChild, lower, al);
+	GatherAsteroidNodeSystem(x, z, r, tree, node.firstChild + 1, upper, al);
+}
+
+/**
+ * System that detects which asteroids should be considered for collision checks, see the QuadTree version
+ */
+static void GatherAsteroidSystem(const float& x, const float& z, const float& r, const KdTree& tree, vector<Location>& al /*OUT*/)
+{
+	if (!tree.nodes.empty() && tree.entries.size() > 0)
+	{
+		GatherAsteroidNodeSystem(x, z, r, tree, 0, { tree.minX, tree.maxX, tree.minZ, tree.maxZ }, al);
+	}
+}
+
+/**
+ * Recursive part of CullAsteroidsSystem
+ */
+template<typename Found>
+static void CullAsteroidsNodeSystem(const FrustumQuad& frustum, const KdTree& tree, const int at, const KdTreeBox& box, Found& found)
+{
+	// grow the box by the margin so that discs sticking out of the node are not culled
+	const float& margin = tree.boundsMargin;
+	const float minX = box.minX - margin, maxX = box.maxX + margin;
+	const float minZ = box.minZ - margin, maxZ = box.maxZ + margin;
+	if (ClassifyBoxInFrustum(frustum, minX, minZ, maxX, maxZ) == FrustumOverlap::Outside)
+	{
+		return;
+	}
+	
+	const KdTreeNode& node = tree.nodes[at];
+	if (node.axis < 0)
+	{
+		const auto& entries = tree.entries;
+		const unsigned int& first = node.firstAsteroid;
+		ScanDiscsInFrustum(&entries.x[first], &entries.z[first], &entries.rds[first], node.asteroidCount, frustum.edges,
+			[&](const unsigned int i){ found(entries.index[first + i]); });
+		return;
+	}
+	
+	KdTreeBox lower, upper;
+	SplitKdTreeBox(node, box, lower, upper);
+	CullAsteroidsNodeSystem(frustum, tree, node.firstChild, lower, found);
+	CullAsteroidsNodeSystem(frustum, tree, node.firstChild + 1, upper, found);
+}
+
+/**
+ * System for culling asteroids based on the KdTree, found(index) is called for every asteroid in the frustum
+ */
+template<typename Found>
+static void CullAsteroidsSystem(const float& x1, const float& z1, const float& x2, const float& z2,
+					  const float& x3, const float& z3, const float& x4, const float& z4, const KdTree& tree, Found found)
+{
+	if (!tree.nodes.empty() && tree.entries.size() > 0)
+	{
+		CullAsteroidsNodeSystem(MakeFrustumQuad(x1, z1, x2, z2, x3, z3, x4, z4), tree, 0,
+			{ tree.minX, tree.maxX, tree.minZ, tree.maxZ }, found);
+	}
+}
+
+// The KdTree fits its root box to the asteroids, the square is not needed
+static void SpatialIndexBuildSystem(KdTree& tree, const float, const float, const float,
+	const Asteroids& asteroids, const unsigned int length)
+{
+	KdTreeInitializeSystem(asteroids, length, tree);
+}
+
+static const char* SpatialIndexName(const KdTree&) { return "k-d tree"; }
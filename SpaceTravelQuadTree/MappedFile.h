@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Read only view of a whole file mapped into memory, unmapped when destroyed.
+ * The pages are loaded by the OS on first access, nothing is read up front.
+ */
+class MappedFile
+{
+public:
+	MappedFile(){bytes = nullptr; length = 0;}
+	~MappedFile() { Close(); }
+	
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	
+	// @return false if the file does not exist, is empty or cannot be mapped
+	bool Open(const char* path)
+	{
+		Close();
+#ifdef _WIN32
+		const HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		LARGE_INTEGER fileSize;
+		if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+		{
+			// the view keeps the mapping alive, both handles can be closed right away
+			const HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping != nullptr)
+			{
+				bytes = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+				length = bytes != nullptr ? static_cast<size_t>(fileSize.QuadPart) : 0;
+				CloseHandle(mapping);
+			}
+		}
+		CloseHandle(file);
+#else
+		const int file = open(path, O_RDONLY);
+		if (file < 0)
+		{
+			return false;
+		}
+		struct stat info;
+		if (fstat(file, &info) == 0 && info.st_size > 0)
+		{
+			void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+			if (view != MAP_FAILED)
+			{
+				bytes = static_cast<const unsigned char*>(view);
+				length = static_cast<size_t>(info.st_size);
+			}
+		}
+		close(file);
+#endif
+		return bytes != nullptr;
+	}
+	
+	void Close()
+	{
+		if (bytes != nullptr)
+		{
+#ifdef _WIN32
+			UnmapViewOfFile(bytes);
+#else
+			munmap(const_cast<unsigned char*>(bytes), length);
+#endif
+		}
+		bytes = nullptr;
+		length = 0;
+	}
+	
+	const unsigned char* data() const { return bytes; }
+	size_t size() const { return length; }
+
+private:
+	const unsigned char* bytes;
+	size_t length;
+};
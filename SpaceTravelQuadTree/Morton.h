@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+
+using namespace std;
+
+// Number of bits used per axis, which is also the deepest level a Morton built QuadTree can reach
+constexpr auto MORTON_BITS = 16;
+constexpr auto MORTON_CELLS = 1u << MORTON_BITS;
+
+// Insert a 0 bit between each of the lower 16 bits of v
+static unsigned int SpreadBits(unsigned int v)
+{
+	v &= 0x0000ffff;
+	v = (v | (v << 8)) & 0x00ff00ff;
+	v = (v | (v << 4)) & 0x0f0f0f0f;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+// Interleave the cell co-ordinates, x takes the higher bit of every pair so that the
+// 2 bit digit of a level matches the QuadTree child slot (SW, NW, SE, NE)
+static unsigned int MortonEncode(const unsigned int x, const unsigned int z)
+{
+	return (SpreadBits(x) << 1) | SpreadBits(z);
+}
+
+/**
+ * System for sorting the keys together with their values.
+ * LSD radix sort with 8 bit digits, 4 passes over the data no matter how many items there are.
+ * @param keyScratch, valueScratch memory the sort ping-pongs with, resized if needed
+ */
+static void RadixSortSystem(vector<unsigned int>& keys, vector<unsigned int>& values,
+	vector<unsigned int>& keyScratch, vector<unsigned int>& valueScratch)
+{
+	const size_t length = keys.size();
+	keyScratch.resize(length);
+	valueScratch.resize(length);
+	
+	for (unsigned int shift = 0; shift < 32; shift += 8)
+	{
+		size_t offsets[256] = {};
+		for (size_t i = 0; i < length; ++i)
+		{
+			++offsets[(keys[i] >> shift) & 0xff];
+		}
+		
+		size_t sum = 0;
+		for (auto& offset : offsets)
+		{
+			const size_t count = offset;
+			offset = sum;
+			sum += count;
+		}
+		
+		for (size_t i = 0; i < length; ++i)
+		{
+			const size_t at = offsets[(keys[i] >> shift) & 0xff]++;
+			keyScratch[at] = keys[i];
+			valueScratch[at] = values[i];
+		}
+		keys.swap(keyScratch);
+		values.swap(valueScratch);
+	}
+}
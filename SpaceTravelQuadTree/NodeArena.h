@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+/**
+ * Bump allocator for the nodes of the QuadTree.
+ * Memory is reserved in large blocks and handed out by moving an offset, items are never freed one by one.
+ * Reset() drops every item in O(1) and keeps the blocks for the next build, so rebuilding the tree
+ * over and over does not grow the memory. The items stay contiguous since the tree links them by index.
+ * No constructors or destructors are run, hence T has to be trivially copyable.
+ */
+template <typename T, size_t BlockSize = 4096>
+class NodeArena
+{
+	static_assert(std::is_trivially_copyable<T>::value, "NodeArena never runs constructors or destructors");
+	
+public:
+	NodeArena(){items = nullptr; count = capacity = 0;}
+	~NodeArena(){Release();}
+	
+	NodeArena(NodeArena&& other)
+	{
+		items = other.items; count = other.count; capacity = other.capacity;
+		other.items = nullptr; other.count = other.capacity = 0;
+	}
+	NodeArena& operator=(NodeArena&& other)
+	{
+		if (this != &other)
+		{
+			Release();
+			items = other.items; count = other.count; capacity = other.capacity;
+			other.items = nullptr; other.count = other.capacity = 0;
+		}
+		return *this;
+	}
+	NodeArena(const NodeArena&) = delete;
+	NodeArena& operator=(const NodeArena&) = delete;
+	
+	// Reserve n items at the end, returns the index of the first one
+	size_t Allocate(const size_t n)
+	{
+		if (count + n > capacity)
+		{
+			Grow(count + n);
+		}
+		const size_t at = count;
+		count += n;
+		return at;
+	}
+	
+	// Copy n items to the end, returns the index of the first one
+	size_t Append(const T* source, const size_t n)
+	{
+		const size_t at = Allocate(n);
+		if (n > 0)
+		{
+			memcpy(items + at, source, n * sizeof(T));
+		}
+		return at;
+	}
+	
+	void push_back(const T& item)
+	{
+		const size_t at = Allocate(1); // may move the items
+		items[at] = item;
+	}
+	
+	// Forget every item, the memory is kept for the next allocations
+	void Reset() { count = 0; }
+	
+	// Give the memory back
+	void Release()
+	{
+		free(items);
+		items = nullptr;
+		count = capacity = 0;
+	}
+	
+	T& operator[](const size_t i) { return items[i]; }
+	const T& operator[](const size_t i) const { return items[i]; }
+	T* data() { return items; }
+	const T* data() const { return items; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	size_t CapacityBytes() const { return capacity * sizeof(T); }
+	
+private:
+	// grow by whole blocks, at least doubling so that a build needs only a handful of them
+	void Grow(const size_t required)
+	{
+		size_t newCapacity = capacity * 2 > required ? capacity * 2 : required;
+		newCapacity = (newCapacity + BlockSize - 1) / BlockSize * BlockSize;
+		// on failure realloc leaves the old block alone, it stays owned by the arena
+		T* grown = static_cast<T*>(realloc(items, newCapacity * sizeof(T)));
+		if (grown == nullptr)
+		{
+			throw std::bad_alloc();
+		}
+		items = grown;
+		capacity = newCapacity;
+	}
+	
+	T* items;
+	size_t count;
+	size_t capacity;
+};
@@ -0,0 +1,355 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+#include "QuadTree.h"
+
+// Octree over the asteroid centres, the 3D counterpart of the QuadTree for fields that fill a volume.
+// It implements the SpatialIndex interface, where the x/z queries see every node as a vertical column,
+// and has its own queries against spheres and a real 3D view frustum, which only visit the cubes in view.
+// Every node holds its asteroids as one range of entries and splits it into the occupied octants, so like
+// the QuadTree only occupied children exist and they are stored next to each other.
+
+using namespace std;
+
+constexpr auto OCTREE_LEAF_CAPACITY = 16u; // nodes with more asteroids than this are split
+constexpr auto OCTREE_MAX_DEPTH = 10; // unless they are this deep
+
+// View frustum of the app, glFrustum(-5.0, 5.0, -5.0, 5.0, 5.0, 250.0) in setup(): 45 degrees to every side
+constexpr float VIEW_TAN_HALF_ANGLE = 1.f;
+constexpr float VIEW_NEAR = 5.f;
+constexpr float VIEW_FAR = 250.f;
+
+// Node of the Octree, a cube
+struct OctreeNode
+{
+	float minX, minY, minZ; // corner of the cube with the smallest co-ordinates
+	float size; // side length of the cube
+	int firstChild; // index of the first occupied child in Octree::nodes, -1 if the node is a leaf
+	unsigned int childCount; // occupied octants, their nodes follow firstChild in octant order
+	unsigned int firstAsteroid, asteroidCount; // the whole subtree is one range of Octree::entries
+};
+
+struct Octree
+{
+	Octree(){boundsMargin = 0.f;}
+	
+	std::vector<OctreeNode> nodes; // breadth-first, nodes[0] is the root
+	QuadTreeEntries entries; // asteroids in tree order
+	std::vector<Location> buildAsteroids; // buffer the builder partitions, kept for its memory
+	float boundsMargin; // largest radius, how far a sphere may stick out of the cube of its node
+};
+
+// Axis aligned box a query tests the nodes with
+struct OctreeBox
+{
+	float minX, minY, minZ, maxX, maxY, maxZ;
+};
+
+// Octant of a node holding (x,y,z), bit 0 is the upper x half, bit 1 the upper y half, bit 2 the upper z half
+static int OctantOf(const OctreeNode& node, const float x, const float y, const float z)
+{
+	const float half = node.size / 2.f;
+	return (x >= node.minX + half ? 1 : 0) | (y >= node.minY + half ? 2 : 0) | (z >= node.minZ + half ? 4 : 0);
+}
+
+/**
+ * Inward facing planes of the view frustum of a camera at eye looking along forward
+ * @param tanHalfAngle tangent of the angle between the view direction and every side plane
+ */
+static FrustumPlanes MakeFrustumPlanes(const glm::vec3& eye, const glm::vec3& forward, const glm::vec3& up,
+	const float tanHalfAngle, const float nearDistance, const float farDistance)
+{
+	const glm::vec3 f = glm::normalize(forward);
+	const glm::vec3 side = glm::normalize(glm::cross(f, up));
+	const glm::vec3 u = glm::cross(side, f);
+	
+	const glm::vec3 normals[6] = {
+		f, -f,
+		glm::normalize(tanHalfAngle * f - side), glm::normalize(tanHalfAngle * f + side),
+		glm::normalize(tanHalfAngle * f - u), glm::normalize(tanHalfAngle * f + u) };
+	
+	FrustumPlanes planes;
+	for (int p = 0; p < 6; ++p)
+	{
+		planes.nx[p] = normals[p].x;
+		planes.ny[p] = normals[p].y;
+		planes.nz[p] = normals[p].z;
+		planes.d[p] = -glm::dot(normals[p], eye);
+	}
+	planes.d[0] -= nearDistance;
+	planes.d[1] += farDistance;
+	return planes;
+}
+
+// Is the box not entirely outside one of the frustum planes? Conservative near the frustum edges.
+static bool BoxInFrustum(const FrustumPlanes& planes, const OctreeBox& box)
+{
+	for (int p = 0; p < 6; ++p)
+	{
+		// the corner furthest along the normal
+		const float x = planes.nx[p] >= 0.f ? box.maxX : box.minX;
+		const float y = planes.ny[p] >= 0.f ? box.maxY : box.minY;
+		const float z = planes.nz[p] >= 0.f ? box.maxZ : box.minZ;
+		if (planes.nx[p] * x + planes.ny[p] * y + planes.nz[p] * z + planes.d[p] < 0.f)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * System for building the Octree over the cube with the SW corner (x,z) of the square of side s at its base
+ * The cube is grown to hold every centre and centred on the asteroids vertically.
+ * Nodes are split in the order they are stored like the KdTree builder.
+ */
+static void OctreeInitializeSystem(const float x, const float z, const float s,
+	const Asteroids& asteroids, const unsigned int length, Octree& octree)
+{
+	auto& buildAsteroids = octree.buildAsteroids;
+	buildAsteroids.clear();
+	octree.boundsMargin = 0.f;
+	OctreeBox centres = { x, FLT_MAX, z - s, x + s, -FLT_MAX, z };
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		if (asteroids.rds[i] > 0.f)
+		{
+			buildAsteroids.push_back({ asteroids.x[i], asteroids.y[i], asteroids.z[i], asteroids.rds[i], i });
+			centres.minX = glm::min(centres.minX, asteroids.x[i]);
+			centres.minY = glm::min(centres.minY, asteroids.y[i]);
+			centres.minZ = glm::min(centres.minZ, asteroids.z[i]);
+			centres.maxX = glm::max(centres.maxX, asteroids.x[i]);
+			centres.maxY = glm::max(centres.maxY, asteroids.y[i]);
+			centres.maxZ = glm::max(centres.maxZ, asteroids.z[i]);
+			octree.boundsMargin = glm::max(octree.boundsMargin, asteroids.rds[i]);
+		}
+	}
+	if (buildAsteroids.empty())
+	{
+		centres.minY = centres.maxY = 0.f;
+	}
+	
+	// the upper faces of a cube are outside of it, the size is grown a bit so the largest centres fall inside
+	const float size = glm::max(glm::max(centres.maxX - centres.minX, centres.maxY - centres.minY), centres.maxZ - centres.minZ) * 1.0001f + 1.f;
+	OctreeNode root;
+	root.minX = centres.minX;
+	root.minY = (centres.minY + centres.maxY - size) / 2.f;
+	root.minZ = centres.minZ;
+	root.size = size;
+	root.firstChild = -1;
+	root.childCount = 0;
+	root.firstAsteroid = 0;
+	root.asteroidCount = static_cast<unsigned int>(buildAsteroids.size());
+	
+	auto& nodes = octree.nodes;
+	nodes.assign(1, root);
+	vector<int> depths(1, 0);
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		const OctreeNode node = nodes[i];
+		if (node.asteroidCount <= OCTREE_LEAF_CAPACITY || depths[i] >= OCTREE_MAX_DEPTH)
+		{
+			continue;
+		}
+	
+		// sort the range by octant, z halves first then y then x, so the octants come out in order
+		const auto begin = buildAsteroids.begin() + node.firstAsteroid;
+		const auto byOctant = [&node](const int bit)
+		{
+			return [&node, bit](const Location& loc){ return (OctantOf(node, loc.x, loc.y, loc.z) & bit) == 0; };
+		};
+		vector<Location>::iterator bounds[9];
+		bounds[0] = begin;
+		bounds[8] = begin + node.asteroidCount;
+		bounds[4] = partition(bounds[0], bounds[8], byOctant(4));
+		for (int zHalf = 0; zHalf < 8; zHalf += 4)
+		{
+			bounds[zHalf + 2] = partition(bounds[zHalf], bounds[zHalf + 4], byOctant(2));
+			for (int yHalf = zHalf; yHalf < zHalf + 4; yHalf += 2)
+			{
+				bounds[yHalf + 1] = partition(bounds[yHalf], bounds[yHalf + 2], byOctant(1));
+			}
+		}
+	
+		nodes[i].firstChild = static_cast<int>(nodes.size());
+		const float half = node.size / 2.f;
+		for (int octant = 0; octant < 8; ++octant)
+		{
+			if (bounds[octant + 1] == bounds[octant])
+			{
+				continue;
+			}
+			OctreeNode child;
+			child.minX = node.minX + (octant & 1 ? half : 0.f);
+			child.minY = node.minY + (octant & 2 ? half : 0.f);
+			child.minZ = node.minZ + (octant & 4 ? half : 0.f);
+			child.size = half;
+			child.firstChild = -1;
+			child.childCount = 0;
+			child.firstAsteroid = static_cast<unsigned int>(bounds[octant] - buildAsteroids.begin());
+			child.asteroidCount = static_cast<unsigned int>(bounds[octant + 1] - bounds[octant]);
+			nodes.push_back(child);
+			depths.push_back(depths[i] + 1);
+			++nodes[i].childCount;
+		}
+	}
+	
+	const size_t count = buildAsteroids.size();
+	auto& entries = octree.entries;
+	entries.x.assign(count + SIMD_WIDTH - 1, 0.f);
+	entries.y.assign(count + SIMD_WIDTH - 1, 0.f);
+	entries.z.assign(count + SIMD_WIDTH - 1, 0.f);
+	entries.rds.assign(count + SIMD_WIDTH - 1, 0.f);
+	entries.index.resize(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const Location& loc = buildAsteroids[i];
+		entries.x[i] = loc.x;
+		entries.y[i] = loc.y;
+		entries.z[i] = loc.z;
+		entries.rds[i] = loc.rds;
+		entries.index[i] = loc.index;
+	}
+}
+
+/**
+ * Recursive part of every Octree query
+ * @param overlaps called with the box of a node grown by the margin, false skips the subtree
+ * @param scan called with the entry range of every leaf that overlaps
+ */
+template<typename Overlaps, typename Scan>
+static void OctreeQueryNodeSystem(const Octree& octree, const int at, Overlaps& overlaps, Scan& scan)
+{
+	const OctreeNode& node = octree.nodes[at];
+	const float& margin = octree.boundsMargin;
+	const OctreeBox box = { node.minX - margin, node.minY - margin, node.minZ - margin,
+		node.minX + node.size + margin, node.minY + node.size + margin, node.minZ + node.size + margin };
+	if (!overlaps(box))
+	{
+		return;
+	}
+	
+	if (node.firstChild < 0)
+	{
+		scan(node.firstAsteroid, node.asteroidCount);
+		return;
+	}
+	for (unsigned int child = 0; child < node.childCount; ++child)
+	{
+		OctreeQueryNodeSystem(octree, node.firstChild + child, overlaps, scan);
+	}
+}
+
+/**
+ * System that detects which asteroids may touch the sphere centred (x,y,z) with radius r
+ */
+static void GatherAsteroidSystem(const float& x, const float& y, const float& z, const float& r,
+	const Octree& octree, vector<Location>& al /*OUT*/)
+{
+	if (octree.entries.size() == 0)
+	{
+		return;
+	}
+	
+	const auto& entries = octree.entries;
+	auto overlaps = [&](const OctreeBox& box)
+	{
+		const float dx = x - glm::clamp(x, box.minX, box.maxX);
+		const float dy = y - glm::clamp(y, box.minY, box.maxY);
+		const float dz = z - glm::clamp(z, box.minZ, box.maxZ);
+		return dx * dx + dy * dy + dz * dz <= r * r;
+	};
+	auto scan = [&](const unsigned int first, const unsigned int count)
+	{
+		ScanSpheresNearPoint(&entries.x[first], &entries.y[first], &entries.z[first], &entries.rds[first], count, x, y, z, r,
+			[&](const unsigned int i){ al.push_back(entries.at(first + i)); });
+	};
+	OctreeQueryNodeSystem(octree, 0, overlaps, scan);
+}
+
+/**
+ * System for culling asteroids against a 3D view frustum, found(index) is called for every asteroid in it
+ */
+template<typename Found>
+static void CullAsteroidsSystem(const FrustumPlanes& planes, const Octree& octree, Found found)
+{
+	if (octree.entries.size() == 0)
+	{
+		return;
+	}
+	
+	const auto& entries = octree.entries;
+	auto overlaps = [&planes](const OctreeBox& box){ return BoxInFrustum(planes, box); };
+	auto scan = [&](const unsigned int first, const unsigned int count)
+	{
+		ScanSpheresInFrustum(&entries.x[first], &entries.y[first], &entries.z[first], &entries.rds[first], count, planes,
+			[&](const unsigned int i){ found(entries.index[first + i]); });
+	};
+	OctreeQueryNodeSystem(octree, 0, overlaps, scan);
+}
+
+/**
+ * System for Drawing the asteroids in a 3D view frustum
+ */
+static void DrawAsteroidsSystem(const FrustumPlanes& planes, const Octree& octree)
+{
+	CullAsteroidsSystem(planes, octree, [](const unsigned int at){ drawAsteroid(at); });
+}
+
+/**
+ * System that detects which asteroids should be considered for collision checks, see the QuadTree version
+ * Only x and z are looked at, every node is a vertical column.
+ */
+static void GatherAsteroidSystem(const float& x, const float& z, const float& r, const Octree& octree, vector<Location>& al /*OUT*/)
+{
+	if (octree.entries.size() == 0)
+	{
+		return;
+	}
+	
+	const auto& entries = octree.entries;
+	auto overlaps = [&](const OctreeBox& box){ return checkDiscRectangleIntersection(box.minX, box.minZ, box.maxX, box.maxZ, x, z, r) != 0; };
+	auto scan = [&](const unsigned int first, const unsigned int count)
+	{
+		ScanDiscsNearPoint(&entries.x[first], &entries.z[first], &entries.rds[first], count, x, z, r,
+			[&](const unsigned int i){ al.push_back(entries.at(first + i)); });
+	};
+	OctreeQueryNodeSystem(octree, 0, overlaps, scan);
+}
+
+/**
+ * System for culling asteroids against a frustum quadrilateral in the x/z plane, see the QuadTree version
+ * Only x and z are looked at, every node is a vertical column.
+ */
+template<typename Found>
+static void CullAsteroidsSystem(const float& x1, const float& z1, const float& x2, const float& z2,
+					  const float& x3, const float& z3, const float& x4, const float& z4, const Octree& octree, Found found)
+{
+	if (octree.entries.size() == 0)
+	{
+		return;
+	}
+	
+	const auto& entries = octree.entries;
+	const FrustumQuad frustum = MakeFrustumQuad(x1, z1, x2, z2, x3, z3, x4, z4);
+	auto overlaps = [&](const OctreeBox& box)
+	{
+		return ClassifyBoxInFrustum(frustum, box.minX, box.minZ, box.maxX, box.maxZ) != FrustumOverlap::Outside;
+	};
+	auto scan = [&](const unsigned int first, const unsigned int count)
+	{
+		ScanDiscsInFrustum(&entries.x[first], &entries.z[first], &entries.rds[first], count, frustum.edges,
+			[&](const unsigned int i){ found(entries.index[first + i]); });
+	};
+	OctreeQueryNodeSystem(octree, 0, overlaps, scan);
+}
+
+static void SpatialIndexBuildSystem(Octree& octree, const float x, const float z, const float s,
+	const Asteroids& asteroids, const unsigned int length)
+{
+	OctreeInitializeSystem(x, z, s, asteroids, length, octree);
+}
+
+static const char* SpatialIndexName(const Octree&) { return "octree"; }
@@ -1,203 +1,1300 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <memory>
 #include <vector>
 #include "Asteroid.h"
+#include "BucketScan.h"
+#include "Morton.h"
+#include "NodeArena.h"
+#include "QueryStats.h"
+#include "SpatialIndex.h"
+#include "TaskPool.h"
 #include "intersectionDetectionRoutines.h"
 
-// func to draw the asteroids (Bottleneck since every sphere is a separate draw call)
-extern void drawAsteroid(const unsigned int at);
+/**
+ * Node of the linear QuadTree, the links every traversal follows.
+ * Every node lives in QuadTree::nodes, so no node is ever heap allocated on its own. Only the children
+ * holding asteroids exist, they are stored next to each other starting at firstChild in Morton order
+ * (SW, NW, SE, NE) and childMask tells which quadrants they cover.
+ * The square of a node is not stored: it follows from QuadTree::root and the quadrants on the path down to
+ * the node, so the traversals derive it while descending.
+ * The bucket lives in QuadTree::buckets under the same index. Small buckets, every leaf of a default tree,
+ * are also inlined in the node, so the traversals go straight from the node to the entries.
+ * Only the count of a bigger bucket has to be read from QuadTree::buckets.
+ */
+struct QuadTreeNode
+{
+	QuadTreeNode(){firstChild = -1; childMask = 0; overflow = 0; firstAsteroid = 0; asteroidCount = 0;}
+	
+	int firstChild : 27; // index of the first occupied child in QuadTree::nodes, -1 if the node is a leaf
+	unsigned int childMask : 4; // bit QUAD_* set for every occupied quadrant
+	unsigned int overflow : 1; // 1 if the bucket holds more than QUADTREE_INLINE_ASTEROIDS items
+	
+	unsigned int firstAsteroid : 27; // copy of QuadTreeBucket::firstAsteroid
+	unsigned int asteroidCount : 5; // copy of QuadTreeBucket::asteroidCount, 0 when overflow is set
+};
 
-struct Location
+static_assert(sizeof(QuadTreeNode) == 8, "QuadTreeNode is expected to be 8 bytes, eight to a cache line");
+
+// Largest bucket whose range is inlined in its QuadTreeNode
+constexpr auto QUADTREE_INLINE_ASTEROIDS = 31u;
+
+// Square covered by a node
+struct QuadTreeCell
 {
-	float x;
-	float y;
-	float z;
-	float rds; // radius
-	unsigned int index;
+	QuadTreeCell(){SWCornerX = SWCornerZ = size = 0.f;}
+	QuadTreeCell(const float x, const float z, const float s){SWCornerX = x; SWCornerZ = z; size = s;}
+	
+	float SWCornerX, SWCornerZ; // x and z co-ordinates of the SW corner of the square.
+	float size; // Side length of square.
 };
 
-struct QuadTreeNode
+// Bucket of a QuadTree node, the cold part of the node only read where it holds more than QUADTREE_INLINE_ASTEROIDS items.
+// The incremental updates work on the buckets and copy the result into the node with InlineBucket.
+struct QuadTreeBucket
 {
-	QuadTreeNode(){size = 0;}
-	QuadTreeNode(const float x, const float z, const float s)
-	{
-		SWCornerX = x; SWCornerZ = z; size = s;
-		SWChild = NWChild = NEChild = SEChild = nullptr;
-	}
+	QuadTreeBucket(){firstAsteroid = asteroidCount = asteroidCapacity = splitRetryCount = 0;}
 	
-	QuadTreeNode *SWChild, *NWChild, *NEChild, *SEChild; // Children nodes.
+	unsigned int firstAsteroid; // start of the items of this node in QuadTree::entries
+	unsigned int asteroidCount; // leaf nodes store up to QuadTree::leafCapacity items, inner nodes the discs straddling their children
+	unsigned int asteroidCapacity; // slots reserved for the node in QuadTree::entries, equal to asteroidCount after a build
+	unsigned int splitRetryCount; // a leaf the updates failed to split is only tried again once it holds this many items
+};
+
+// Copies the range of a bucket into its node
+static void InlineBucket(QuadTreeNode& node, const QuadTreeBucket& bucket)
+{
+	node.firstAsteroid = bucket.firstAsteroid;
+	node.overflow = bucket.asteroidCount > QUADTREE_INLINE_ASTEROIDS;
+	node.asteroidCount = node.overflow ? 0 : bucket.asteroidCount;
+}
+
+// Quadrants of a node, also the bits of QuadTreeNode::childMask
+constexpr int QUAD_SW = 0;
+constexpr int QUAD_NW = 1;
+constexpr int QUAD_SE = 2;
+constexpr int QUAD_NE = 3;
+
+// Available ways of building the QuadTree
+enum class QuadTreeBuildMode
+{
+	Recursive, // top-down, every level partitions the asteroid range of the node in place
+	Parallel, // Recursive with the big nodes partitioned by all threads and the subtrees below built as tasks
+	Morton // bottom-up bulk load from radix sorted Morton keys, loose trees are built with Recursive instead
+};
+
+// Nodes holding fewer asteroids are built serially by one task, bigger ones are partitioned by all the threads.
+// Also the smallest slice of a pass over all the asteroids handed to one thread, below this a task costs more than it saves.
+constexpr auto PARALLEL_BUILD_MIN_TASK_ASTEROIDS = 16384u;
+
+using QuadTreeNodeArena = NodeArena<QuadTreeNode>;
+using QuadTreeBucketArena = NodeArena<QuadTreeBucket>;
+
+// Subtree built by one task of the Parallel build, nodes[0] is the root of the subtree
+struct QuadTreeSegment
+{
+	QuadTreeSegment(){at = 0; limitHits = 0;}
+	QuadTreeNodeArena nodes;
+	QuadTreeBucketArena buckets;
+	QuadTreeCell cell; // square of nodes[0]
+	int at; // index of nodes[0] in QuadTree::nodes
+	unsigned int limitHits;
+};
+
+// Threads and buffers of the Parallel build, kept between builds like the arenas of the QuadTree
+struct QuadTreeParallelBuild
+{
+	explicit QuadTreeParallelBuild(const unsigned int threadCount = thread::hardware_concurrency()) : pool(threadCount) {}
 	
-	std::vector<Location> asteroidLocations; // global list of asteroid locations to process (reduced every time the tree is subdivided)
-	std::vector<Location> nodeAsteroids; // local list of asteroid locations, leaf nodes store 1 item
+	TaskPool pool;
+	std::vector<Location> scattered; // the big nodes are partitioned into this buffer and copied back
+	std::vector<QuadTreeSegment> segments; // subtrees below the big nodes, one task each
+};
+
+// Deepest level any build creates whatever QuadTree::maxDepth says, bounds the explicit stacks of the traversals
+constexpr auto QUADTREE_STACK_DEPTH = 64u;
+// A depth-first walk keeps at most 3 siblings per level waiting plus the node it is about to visit
+constexpr auto QUADTREE_STACK_SIZE = 3 * QUADTREE_STACK_DEPTH + 1;
+// Most frustums a single walk culls against, one bit each in the masks the walk carries down, more take several walks
+constexpr auto QUADTREE_MAX_FRUSTUMS = 32u;
+
+// Default number of asteroids a leaf may hold before it is split, see the leaf capacity sweep of the benchmark
+constexpr auto QUADTREE_LEAF_CAPACITY = 16u;
+// Default subdivision limits, nodes reaching them stay leaves with more than leafCapacity items.
+// Without them discs sharing a centre would be split until float precision gives out.
+constexpr auto QUADTREE_MAX_DEPTH = MORTON_BITS;
+constexpr auto QUADTREE_MIN_CELL_SIZE = 1.f;
+
+// Bump whenever the builders lay out the same input differently, saved snapshots of older builds are ignored then
+constexpr auto QUADTREE_BUILDER_VERSION = 2u;
+
+// Default QuadTree::looseness, 1 keeps every disc inside the square of its node
+constexpr auto QUADTREE_LOOSENESS = 1.f;
+
+// QuadTree::entrySlots value of an asteroid that is not in the tree
+constexpr auto QUADTREE_NO_ENTRY = 0xffffffffu;
+
+/**
+ * Asteroids referenced by the nodes, stored as SoA columns so that a bucket is tested with SIMD.
+ * Every bucket owns the range [firstAsteroid, firstAsteroid + asteroidCount). After a build every subtree is
+ * a contiguous range, incremental changes may leave unused slots between the ranges.
+ * The float columns carry SIMD_WIDTH - 1 padding items at the end.
+ */
+struct QuadTreeEntries
+{
+	std::vector<float> x, y, z, rds;
+	std::vector<unsigned int> index;
 	
-	float SWCornerX, SWCornerZ; // x and z co-ordinates of the SW corner of the square.
-	float size; // Side length of square.
+	size_t size() const { return index.size(); }
+	Location at(const unsigned int i) const { return { x[i], y[i], z[i], rds[i], index[i] }; }
 };
 
 struct QuadTree
 {
-	QuadTree(){length = 0;}
+	QuadTree()
+	{
+		length = 0; boundsMargin = 0.f;
+		leafCapacity = QUADTREE_LEAF_CAPACITY; maxDepth = QUADTREE_MAX_DEPTH; minCellSize = QUADTREE_MIN_CELL_SIZE;
+		looseness = QUADTREE_LOOSENESS;
+		limitedLeaves = 0; buildMilliseconds = 0.f;
+		garbageNodes = garbageEntries = 0; packedEntries = false;
+	}
 
-	QuadTreeNode header; // starting node of the quad tree
+	QuadTreeNodeArena nodes; // breadth-first array of nodes, nodes[0] is the root, freed with the QuadTree
+	QuadTreeCell root; // square of nodes[0], the squares of the other nodes follow from it
+	QuadTreeBucketArena buckets; // bucket of every node, at the same index as the node
+	QuadTreeEntries entries; // asteroids referenced by the nodes
+	std::vector<Location> buildAsteroids; // buffer the builders and SplitLeafSystem partition, kept for its memory
 	Asteroids arrayAsteroids; // Global array of asteroids.
 	int length;
+	float boundsMargin; // how far the asteroids may stick out of the nodes they are stored in
+	unsigned int leafCapacity; // nodes holding more asteroids than this get split
+	unsigned int maxDepth; // nodes at this depth are never split
+	float minCellSize; // nodes are never split into squares smaller than this
+	unsigned int limitedLeaves; // leaves of the last build over leafCapacity because of maxDepth/minCellSize
+	float buildMilliseconds; // duration of the last build, 0 for a tree loaded from a snapshot
+	float looseness; // k > 1 makes a loose tree, every node then holds discs centred in it that fit into its square scaled by k
+	
+	std::vector<unsigned int> entrySlots; // slot in entries of every asteroid index, QUADTREE_NO_ENTRY if not stored
+	unsigned int garbageNodes; // nodes and entry slots left unreachable by incremental changes, reclaimed by the next build
+	unsigned int garbageEntries;
+	bool packedEntries; // every subtree is one range of entries, true after a build until a change leaves a hole
+	std::unique_ptr<QuadTreeParallelBuild> parallelBuild; // made by the first Parallel build and kept for the rebuilds
 };
 
+// Subdivision rules shared by all the builders
+struct QuadTreeSplitPolicy
+{
+	unsigned int leafCapacity;
+	float minChildSize; // maxDepth and minCellSize folded into the smallest square a split may create
+	float looseMargin; // how far a loose node reaches out of its square as a fraction of its size, 0 for a strict tree
+};
+
+// Number of items in the bucket of node at, only reads QuadTree::buckets for an overflowing bucket
+static unsigned int NodeAsteroidCount(const QuadTree& quadTree, const QuadTreeNode& node, const int at)
+{
+	return node.overflow ? quadTree.buckets[at].asteroidCount : node.asteroidCount;
+}
+
+static float LooseMargin(const QuadTree& quadTree)
+{
+	return glm::max(0.f, (quadTree.looseness - 1.f) / 2.f);
+}
+
+// How far the disc centred (x,z) with radius r sticks out of the square along x or z, negative if it lies inside
+static float DiscOverhang(const QuadTreeCell& cell, const float x, const float z, const float r)
+{
+	return glm::max(glm::max(cell.SWCornerX - (x - r), (x + r) - (cell.SWCornerX + cell.size)),
+		glm::max((z + r) - cell.SWCornerZ, (cell.SWCornerZ - cell.size) - (z - r)));
+}
+
+// How far the discs stored in a node may stick out of its square
+static float NodeReach(const QuadTree& quadTree, const QuadTreeCell& cell)
+{
+	return quadTree.boundsMargin + LooseMargin(quadTree) * cell.size;
+}
+
+static QuadTreeSplitPolicy MakeSplitPolicy(const QuadTree& quadTree)
+{
+	// the root size halves exactly at every level, so depth d is the same as size root / 2^d
+	const float rootSize = quadTree.root.size;
+	const float deepestSize = ldexp(rootSize, -static_cast<int>(glm::min(quadTree.maxDepth, QUADTREE_STACK_DEPTH)));
+	return { quadTree.leafCapacity, glm::max(deepestSize, quadTree.minCellSize), LooseMargin(quadTree) };
+}
+
+// True if the disc crosses one of the lines splitting a node into its children
+static bool DiscStraddles(const Location& loc, const float midX, const float midZ)
+{
+	return fabs(loc.x - midX) < loc.rds || fabs(loc.z - midZ) < loc.rds;
+}
+
+/**
+ * True if the disc has to stay in a node instead of moving into the child holding its centre.
+ * A strict tree keeps the discs crossing the split lines, a loose one the discs reaching further
+ * out of the child square than childReach, whatever their position.
+ */
+static bool DiscStaysInNode(const Location& loc, const float midX, const float midZ, const float childReach)
+{
+	return childReach > 0.f ? loc.rds > childReach : DiscStraddles(loc, midX, midZ);
+}
+
+// Quadrant of the square holding the point, same rules as the partition of SplitNodeSystem
+static int QuadrantOf(const QuadTreeCell& cell, const float x, const float z)
+{
+	const float halfSize = cell.size / 2.f;
+	return (x < cell.SWCornerX + halfSize ? 0 : 2) | (z > cell.SWCornerZ - halfSize ? 0 : 1);
+}
+
+// Index in QuadTree::nodes of the child covering an occupied quadrant
+static int ChildIndex(const QuadTreeNode& node, const int quadrant)
+{
+	int child = node.firstChild;
+	for (unsigned int below = node.childMask & ((1u << quadrant) - 1); below != 0; below &= below - 1)
+	{
+		++child;
+	}
+	return child;
+}
+
+// Number of occupied children of a node
+static int ChildCount(const QuadTreeNode& node)
+{
+	int count = 0;
+	for (unsigned int mask = node.childMask; mask != 0; mask &= mask - 1)
+	{
+		++count;
+	}
+	return count;
+}
+
+// Square covering the given quadrant of the parent square
+static QuadTreeCell ChildCell(const QuadTreeCell& parent, const int quadrant)
+{
+	const float halfSize = parent.size / 2.f;
+	return QuadTreeCell(parent.SWCornerX + (quadrant >> 1) * halfSize, parent.SWCornerZ - (quadrant & 1) * halfSize, halfSize);
+}
+
+// Squares of the 4 children of the parent square grown by reach, lane i holds the square ChildCell gives for quadrant i
+static BoxLanes ChildBoxes(const QuadTreeCell& parent, const float reach)
+{
+	const float halfSize = parent.size / 2.f;
+	const __m128 size = _mm_set1_ps(halfSize + 2.f * reach);
+	const __m128 minX = _mm_sub_ps(_mm_add_ps(_mm_set1_ps(parent.SWCornerX), _mm_setr_ps(0.f, 0.f, halfSize, halfSize)),
+		_mm_set1_ps(reach));
+	const __m128 maxZ = _mm_add_ps(_mm_sub_ps(_mm_set1_ps(parent.SWCornerZ), _mm_setr_ps(0.f, halfSize, 0.f, halfSize)),
+		_mm_set1_ps(reach));
+	const BoxLanes boxes = { minX, _mm_sub_ps(maxZ, size), _mm_add_ps(minX, size), maxZ };
+	return boxes;
+}
+
 /**
- * System for detecting how many asteroids are within the bounds of a QuadTree Node
+ * System for subdividing a QuadTree Node
+ * The asteroid range of the node is partitioned in place into [straddling | SW | NW | SE | NE].
+ * Discs crossing the split lines, or too big for a loose child, stay in the node as its overflow list instead
+ * of being copied into every child they touch, the rest is handed to the children as sub-ranges of the same buffer.
+ * @param cell square of the node
+ * @param bucket holds the whole asteroid range of the node when called, only the straddling part afterwards
+ * @param childBuckets output, the asteroid ranges of the 4 children, in the squares ChildCell gives
+ * @param limitHits incremented when the depth or cell size limit keeps an overfull node from splitting
+ * @return false if the node stays a leaf
  */
-static int NumberAsteroidsIntersectedSystem(QuadTreeNode& node)
+static bool SplitNodeSystem(const QuadTreeCell& cell, QuadTreeBucket& bucket, vector<Location>& nodeAsteroids,
+	const QuadTreeSplitPolicy& policy, QuadTreeBucket (&childBuckets)[4] /*OUT*/, unsigned int& limitHits /*OUT*/)
 {
-	int numVal = 0;
+	if (bucket.asteroidCount <= policy.leafCapacity)
+	{
+		return false;
+	}
+	
+	const float halfSize = cell.size / 2.f;
+	if (halfSize < policy.minChildSize)
+	{
+		++limitHits;
+		return false;
+	}
 	
-	const auto& asteroidLocations = node.asteroidLocations;
-	auto& nodeAsteroids = node.nodeAsteroids;
+	const float midX = cell.SWCornerX + halfSize;
+	const float midZ = cell.SWCornerZ - halfSize;
 	
-	const unsigned int& lSize = asteroidLocations.size();
-	const float& SWCornerX = node.SWCornerX;
-	const float& SWCornerZ = node.SWCornerZ;
-	const float& NECornerX = SWCornerX + node.size;
-	const float& NECornerZ = SWCornerZ - node.size;
+	const auto begin = nodeAsteroids.begin() + bucket.firstAsteroid;
+	const auto end = begin + bucket.asteroidCount;
 	
-	for (unsigned int i = 0; i < lSize; i++)
+	const float childReach = policy.looseMargin * halfSize;
+	const auto straddleEnd = partition(begin, end, [midX, midZ, childReach](const Location& loc)
 	{
-		const Location& loc = asteroidLocations[i];
-		const float& radius = loc.rds;
-		if (radius > 0.f)
-   		{
-			const float& c_x = loc.x;
-			const float& c_z = loc.z;
-			
-			if (checkDiscRectangleIntersection( SWCornerX, SWCornerZ, NECornerX, NECornerZ,
-					c_x, c_z, radius )
-				)
-   			{
-   				nodeAsteroids.emplace_back(loc); 
-				++numVal;
-   			}
-   		}
+		return DiscStaysInNode(loc, midX, midZ, childReach);
+	});
+	if (straddleEnd == end)
+	{
+		return false; // nothing fits into a single child, splitting would not help
 	}
-	return numVal;
+	
+	// west before east, then south before north within each half (z decreases towards the north)
+	const auto eastBegin = partition(straddleEnd, end, [midX](const Location& loc){ return loc.x < midX; });
+	const auto northWestBegin = partition(straddleEnd, eastBegin, [midZ](const Location& loc){ return loc.z > midZ; });
+	const auto northEastBegin = partition(eastBegin, end, [midZ](const Location& loc){ return loc.z > midZ; });
+	
+	const vector<Location>::iterator bounds[5] = { straddleEnd, northWestBegin, eastBegin, northEastBegin, end };
+	for (int c = 0; c < 4; ++c)
+	{
+		childBuckets[c].firstAsteroid = static_cast<unsigned int>(bounds[c] - nodeAsteroids.begin());
+		childBuckets[c].asteroidCount = static_cast<unsigned int>(bounds[c + 1] - bounds[c]);
+	}
+	bucket.asteroidCount = static_cast<unsigned int>(straddleEnd - begin);
+	return true;
+}
+
+// Appends the occupied children of the split node at to the back of the arrays, empty quadrants are never materialized
+static void AppendChildrenSystem(QuadTreeNodeArena& nodes, QuadTreeBucketArena& buckets, vector<QuadTreeCell>& cells,
+	const int at, const QuadTreeBucket (&childBuckets)[4])
+{
+	const int firstChild = static_cast<int>(nodes.size());
+	const QuadTreeCell cell = cells[at]; // cells may move as well
+	unsigned char childMask = 0;
+	for (int c = 0; c < 4; ++c)
+	{
+		if (childBuckets[c].asteroidCount > 0)
+		{
+			nodes.push_back(QuadTreeNode()); // may move the nodes
+			buckets.push_back(childBuckets[c]);
+			cells.push_back(ChildCell(cell, c));
+			childMask |= 1 << c;
+		}
+	}
+	nodes[at].firstChild = firstChild;
+	nodes[at].childMask = childMask;
 }
 
 /**
  * System for creating the QuadTree
- * @param node - The head of the QuadTree
+ * Nodes are processed in the order they are stored, which makes the children of a split node
+ * land at the back of the array and the whole tree end up in breadth-first order.
+ * @param nodes holds only the root node when called
+ * @param buckets holds the asteroid range of the root when called
+ * @param rootCell square of the root node
+ * @return how many leaves were kept over capacity by the subdivision limits
  */
-static void BuildSystem(QuadTreeNode& node)
+static unsigned int BuildSystem(QuadTreeNodeArena& nodes, QuadTreeBucketArena& buckets, const QuadTreeCell& rootCell,
+	vector<Location>& nodeAsteroids, const QuadTreeSplitPolicy& policy)
 {
-	const glm::uint length = NumberAsteroidsIntersectedSystem(node);
-	if(length > 1)
+	unsigned int limitHits = 0;
+	QuadTreeBucket childBuckets[4];
+	vector<QuadTreeCell> cells(1, rootCell); // square of every node, only needed while building
+	for (size_t i = 0; i < nodes.size(); ++i)
 	{
-		const float& size = node.size; 
-		const float& SWCornerZ = node.SWCornerZ;
-		const float& SWCornerX = node.SWCornerX;
-		
-		const float& halfSize = size / 2.f;
-		const float& cornerHalfSize = SWCornerZ - halfSize;
-		const float& otherCornerHalfSize = SWCornerX + halfSize;
-		
-		node.SWChild = new QuadTreeNode(SWCornerX, SWCornerZ, halfSize);
-		node.SWChild->asteroidLocations = node.nodeAsteroids;
-		
-		node.NWChild = new QuadTreeNode(SWCornerX, cornerHalfSize, halfSize);
-		node.NWChild->asteroidLocations = node.nodeAsteroids;
+		if (SplitNodeSystem(cells[i], buckets[i], nodeAsteroids, policy, childBuckets, limitHits))
+		{
+			AppendChildrenSystem(nodes, buckets, cells, static_cast<int>(i), childBuckets);
+		}
+	}
+	return limitHits;
+}
 
-		node.NEChild = new QuadTreeNode(otherCornerHalfSize, cornerHalfSize, halfSize);
-		node.NEChild->asteroidLocations = node.nodeAsteroids;
+/**
+ * SplitNodeSystem for the big nodes of the Parallel build
+ * Every chunk of the asteroid range counts its discs per destination, straddling or one of the 4 children.
+ * The prefix sums of the counts give each chunk its own place inside every destination, so the chunks scatter
+ * into QuadTreeParallelBuild::scattered side by side and the range is copied back in the same order as
+ * SplitNodeSystem lays it out. A node too small for more than one chunk is split by SplitNodeSystem.
+ * @param nodeAsteroids may trade its memory with QuadTreeParallelBuild::scattered
+ */
+static bool ParallelSplitNodeSystem(QuadTreeParallelBuild& build, const QuadTreeCell& cell, QuadTreeBucket& bucket,
+	vector<Location>& nodeAsteroids, const QuadTreeSplitPolicy& policy, QuadTreeBucket (&childBuckets)[4] /*OUT*/,
+	unsigned int& limitHits /*OUT*/)
+{
+	TaskPool& pool = build.pool;
+	const unsigned int count = bucket.asteroidCount;
+	const size_t chunks = ParallelChunkCount(pool, count, PARALLEL_BUILD_MIN_TASK_ASTEROIDS);
+	if (chunks <= 1 || count <= policy.leafCapacity)
+	{
+		return SplitNodeSystem(cell, bucket, nodeAsteroids, policy, childBuckets, limitHits);
+	}
+	
+	const float halfSize = cell.size / 2.f;
+	if (halfSize < policy.minChildSize)
+	{
+		++limitHits;
+		return false;
+	}
+	const float midX = cell.SWCornerX + halfSize;
+	const float midZ = cell.SWCornerZ - halfSize;
+	const float childReach = policy.looseMargin * halfSize;
+	const auto destination = [&cell, midX, midZ, childReach](const Location& loc)
+	{
+		return DiscStaysInNode(loc, midX, midZ, childReach) ? 0 : 1 + QuadrantOf(cell, loc.x, loc.z);
+	};
+	
+	Location* const asteroids = nodeAsteroids.data() + bucket.firstAsteroid;
+	vector<unsigned int> starts(5 * chunks, 0); // counts of every chunk per destination, then where the chunk writes them
+	ParallelFor(pool, count, chunks, [&](const size_t chunk, const size_t begin, const size_t end)
+	{
+		unsigned int* counts = &starts[5 * chunk];
+		for (size_t i = begin; i < end; ++i)
+		{
+			++counts[destination(asteroids[i])];
+		}
+	});
+	
+	unsigned int sizes[5] = { 0, 0, 0, 0, 0 };
+	for (size_t chunk = 0; chunk < chunks; ++chunk)
+	{
+		for (int d = 0; d < 5; ++d)
+		{
+			sizes[d] += starts[5 * chunk + d];
+		}
+	}
+	if (sizes[0] == count)
+	{
+		return false; // nothing fits into a single child, splitting would not help
+	}
+	unsigned int next = 0;
+	for (int d = 0; d < 5; ++d)
+	{
+		for (size_t chunk = 0; chunk < chunks; ++chunk)
+		{
+			const unsigned int chunkCount = starts[5 * chunk + d];
+			starts[5 * chunk + d] = next;
+			next += chunkCount;
+		}
+	}
+	
+	// the root owns the whole buffer and swaps it with the scattered one instead of copying it back
+	auto& scattered = build.scattered;
+	const bool whole = bucket.firstAsteroid == 0 && count == nodeAsteroids.size();
+	if (whole || scattered.size() < count)
+	{
+		scattered.resize(count);
+	}
+	ParallelFor(pool, count, chunks, [&](const size_t chunk, const size_t begin, const size_t end)
+	{
+		unsigned int* at = &starts[5 * chunk];
+		for (size_t i = begin; i < end; ++i)
+		{
+			scattered[at[destination(asteroids[i])]++] = asteroids[i];
+		}
+	});
+	if (whole)
+	{
+		nodeAsteroids.swap(scattered);
+	}
+	else
+	{
+		ParallelFor(pool, count, chunks, [&](const size_t, const size_t begin, const size_t end)
+		{
+			copy(scattered.begin() + begin, scattered.begin() + end, asteroids + begin);
+		});
+	}
+	
+	unsigned int first = bucket.firstAsteroid + sizes[0];
+	for (int c = 0; c < 4; ++c)
+	{
+		childBuckets[c].firstAsteroid = first;
+		childBuckets[c].asteroidCount = sizes[1 + c];
+		first += sizes[1 + c];
+	}
+	bucket.asteroidCount = sizes[0];
+	return true;
+}
 
-		node.SEChild = new QuadTreeNode(otherCornerHalfSize, SWCornerZ, halfSize);
-		node.SEChild->asteroidLocations = node.nodeAsteroids;
+/**
+ * System for creating the QuadTree on all cores
+ * The nodes holding at least PARALLEL_BUILD_MIN_TASK_ASTEROIDS are split first, breadth-first like BuildSystem and
+ * straight into the arrays of the tree, each of them partitioned by all the threads. The smaller nodes below them
+ * become subtrees built by one task each. A subtree is then copied once, to its final place at the back of the
+ * arrays, with its indices shifted on the way. Produces the same nodes as BuildSystem, only in another order.
+ * @param build kept alive across rebuilds by the caller, starting the threads costs more than a small build
+ * @return how many leaves were kept over capacity by the subdivision limits
+ */
+static unsigned int ParallelBuildSystem(QuadTreeParallelBuild& build, QuadTreeNodeArena& nodes, QuadTreeBucketArena& buckets,
+	const QuadTreeCell& rootCell, vector<Location>& nodeAsteroids, const QuadTreeSplitPolicy& policy)
+{
+	unsigned int limitHits = 0;
+	QuadTreeBucket childBuckets[4];
+	vector<QuadTreeCell> cells(1, rootCell);
+	auto& segments = build.segments;
+	size_t segmentCount = 0;
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		const unsigned int count = buckets[i].asteroidCount;
+		if (count >= PARALLEL_BUILD_MIN_TASK_ASTEROIDS)
+		{
+			if (ParallelSplitNodeSystem(build, cells[i], buckets[i], nodeAsteroids, policy, childBuckets, limitHits))
+			{
+				AppendChildrenSystem(nodes, buckets, cells, static_cast<int>(i), childBuckets);
+			}
+		}
+		else if (count > policy.leafCapacity)
+		{
+			// the segments keep their blocks between builds like the arenas of the tree
+			if (segmentCount == segments.size())
+			{
+				segments.emplace_back();
+			}
+			QuadTreeSegment& segment = segments[segmentCount++];
+			segment.nodes.Reset();
+			segment.buckets.Reset();
+			segment.nodes.push_back(nodes[i]);
+			segment.buckets.push_back(buckets[i]);
+			segment.cell = cells[i];
+			segment.at = static_cast<int>(i);
+		}
+	}
+	
+	TaskGroup group;
+	for (size_t s = 0; s < segmentCount; ++s)
+	{
+		QuadTreeSegment& segment = segments[s];
+		build.pool.Run(group, [&segment, &nodeAsteroids, &policy]
+		{
+			segment.limitHits = BuildSystem(segment.nodes, segment.buckets, segment.cell, nodeAsteroids, policy);
+		});
+	}
+	build.pool.Wait(group);
+	
+	// local index 0 of a segment goes back to its slot at, local index j > 0 lands at j + offset
+	vector<size_t> offsets(segmentCount);
+	size_t end = nodes.size();
+	for (size_t s = 0; s < segmentCount; ++s)
+	{
+		offsets[s] = end - 1;
+		end += segments[s].nodes.size() - 1;
+		limitHits += segments[s].limitHits;
+	}
+	nodes.Allocate(end - nodes.size());
+	buckets.Allocate(end - buckets.size());
+	for (size_t s = 0; s < segmentCount; ++s)
+	{
+		const QuadTreeSegment& segment = segments[s];
+		const int offset = static_cast<int>(offsets[s]);
+		build.pool.Run(group, [&segment, &nodes, &buckets, offset]
+		{
+			for (size_t j = 0; j < segment.nodes.size(); ++j)
+			{
+				const size_t to = j == 0 ? static_cast<size_t>(segment.at) : j + offset;
+				nodes[to] = segment.nodes[j];
+				buckets[to] = segment.buckets[j];
+				if (nodes[to].firstChild >= 0)
+				{
+					nodes[to].firstChild += offset;
+				}
+			}
+		});
+	}
+	build.pool.Wait(group);
+	return limitHits;
+}
 
-		// no longer need that data, passed down to child
-		node.nodeAsteroids.clear();
-		node.asteroidLocations.clear();
-		
-		BuildSystem(*node.SWChild); BuildSystem(*node.NWChild); BuildSystem(*node.NEChild); BuildSystem(*node.SEChild); 
+/**
+ * Parallel version of the gather of QuadTreeInitializeSystem
+ * Every chunk counts the asteroids it keeps first, so each one knows where its part of buildAsteroids starts.
+ * @return how far the discs stick out of the root square
+ */
+static float ParallelGatherSystem(TaskPool& pool, QuadTree& quadTree)
+{
+	const auto& globalAsteroids = quadTree.arrayAsteroids;
+	const QuadTreeCell& root = quadTree.root;
+	const size_t length = quadTree.length;
+	const size_t chunks = ParallelChunkCount(pool, length, PARALLEL_BUILD_MIN_TASK_ASTEROIDS);
+	
+	vector<unsigned int> starts(chunks + 1, 0);
+	vector<float> overhangs(chunks, 0.f);
+	ParallelFor(pool, length, chunks, [&](const size_t chunk, const size_t begin, const size_t end)
+	{
+		unsigned int kept = 0;
+		float overhang = 0.f;
+		for (size_t i = begin; i < end; ++i)
+		{
+			const float& radius = globalAsteroids.rds[i];
+			if (radius > 0.f)
+			{
+				++kept;
+				overhang = glm::max(overhang, DiscOverhang(root, globalAsteroids.x[i], globalAsteroids.z[i], radius));
+			}
+		}
+		starts[chunk + 1] = kept;
+		overhangs[chunk] = overhang;
+	});
+	float overhang = 0.f;
+	for (size_t chunk = 0; chunk < chunks; ++chunk)
+	{
+		starts[chunk + 1] += starts[chunk];
+		overhang = glm::max(overhang, overhangs[chunk]);
 	}
+	
+	auto& buildAsteroids = quadTree.buildAsteroids;
+	buildAsteroids.resize(starts[chunks]);
+	ParallelFor(pool, length, chunks, [&](const size_t chunk, const size_t begin, const size_t end)
+	{
+		unsigned int at = starts[chunk];
+		for (size_t i = begin; i < end; ++i)
+		{
+			const float& radius = globalAsteroids.rds[i];
+			if (radius > 0.f)
+			{
+				buildAsteroids[at++] = { globalAsteroids.x[i], globalAsteroids.y[i], globalAsteroids.z[i], radius,
+					static_cast<unsigned int>(i) };
+			}
+		}
+	});
+	return overhang;
 }
+
+/**
+ * Recursive part of GatherAsteroidSystem
+ * The node at is already known to be near the query, its 4 child squares are tested together with SSE
+ * and only the occupied children near the query are entered.
+ * @param cell square of the node at, derived from the square of its parent
+ */
+template<typename Stats>
+static void GatherAsteroidNodeSystem(const float& x, const float& z, const float& r, const QuadTree& quadTree, const int at,
+	const QuadTreeCell& cell, vector<Location>& al /*OUT*/, Stats& stats)
+{
+	const QuadTreeNode& node = quadTree.nodes[at];
+	// test the whole bucket of the node against the query disc
+	const unsigned int count = NodeAsteroidCount(quadTree, node, at);
+	if (count > 0)
+	{
+		const auto& entries = quadTree.entries;
+		const unsigned int first = node.firstAsteroid;
+		stats.Test(count);
+		ScanDiscsNearPoint(&entries.x[first], &entries.z[first], &entries.rds[first], count, x, z, r,
+			[&](const unsigned int i){ stats.Accept(); al.push_back(entries.at(first + i)); });
+	}
+	if (node.firstChild < 0)
+	{
+		return;
+	}
+	
+	// the reach bounds the overhang per axis, so the squares grow by it and not the query disc
+	const int near = BoxesNearPoint(ChildBoxes(cell, NodeReach(quadTree, ChildCell(cell, QUAD_SW))), x, z, r);
+	// only the occupied children exist, they follow each other from firstChild on
+	int child = node.firstChild;
+	for (int quadrant = 0; quadrant < 4; ++quadrant)
+	{
+		if (node.childMask & (1 << quadrant))
+		{
+			stats.Visit();
+			if (near & (1 << quadrant))
+			{
+				GatherAsteroidNodeSystem(x, z, r, quadTree, child, ChildCell(cell, quadrant), al, stats);
+			}
+			++child;
+		}
+	}
+};
+
 /**
  * System that detects which asteroids should be considered for collision checks
+ * @param r radius of the bounding disc of the colliding object centered at (x,z)
  * @param al output vector of the asteroid locations to consider collision
+ * @param stats QueryStats to count the work of the query, NoQueryStats to count nothing
  */
-static void GatherAsteroidSystem(const float& x, const float& z, const QuadTreeNode& node, vector<Location>& al /*OUT*/)
+template<typename Stats>
+static void GatherAsteroidSystem(const float& x, const float& z, const float& r, const QuadTree& quadTree, vector<Location>& al /*OUT*/,
+	Stats& stats /*OUT*/)
 {
-	const float& size = node.size; 
-	const float& SWCornerZ = node.SWCornerZ;
-	const float& SWCornerX = node.SWCornerX;
+	if (quadTree.nodes.empty() || quadTree.entries.size() == 0)
+	{
+		return;
+	}
+	
+	// the root has no siblings, it is the only square tested on its own
+	const QuadTreeCell& root = quadTree.root;
+	const float reach = NodeReach(quadTree, root);
+	stats.Visit();
+	if (checkDiscRectangleIntersection(root.SWCornerX - reach, root.SWCornerZ + reach,
+		root.SWCornerX + root.size + reach, root.SWCornerZ - root.size - reach, x, z, r))
+	{
+		GatherAsteroidNodeSystem(x, z, r, quadTree, 0, root, al, stats);
+	}
+};
+
+static void GatherAsteroidSystem(const float& x, const float& z, const float& r, const QuadTree& quadTree, vector<Location>& al /*OUT*/)
+{
+	NoQueryStats stats;
+	GatherAsteroidSystem(x, z, r, quadTree, al, stats);
+};
+
+/**
+ * System for reporting every asteroid stored in the subtree of node at without testing it
+ * A packed subtree is the range from the bucket of its root to the end of the bucket of its last leaf,
+ * otherwise the buckets of the subtree are walked one by one.
+ */
+template<typename Found, typename Stats>
+static void AcceptSubtreeSystem(const QuadTree& quadTree, const int at, Found& found, Stats& stats /*OUT*/)
+{
+	const auto& nodes = quadTree.nodes;
+	const auto& entries = quadTree.entries;
+	if (quadTree.packedEntries)
+	{
+		int last = at;
+		while (nodes[last].firstChild >= 0)
+		{
+			last = nodes[last].firstChild + ChildCount(nodes[last]) - 1;
+		}
+		const unsigned int end = nodes[last].firstAsteroid + NodeAsteroidCount(quadTree, nodes[last], last);
+		for (unsigned int i = nodes[at].firstAsteroid; i < end; ++i)
+		{
+			stats.Accept();
+			found(entries.index[i]);
+		}
+		return;
+	}
+	
+	int stack[QUADTREE_STACK_SIZE];
+	int top = 0;
+	stack[top++] = at;
+	while (top > 0)
+	{
+		const int next = stack[--top];
+		const QuadTreeNode& node = nodes[next];
+		const unsigned int count = NodeAsteroidCount(quadTree, node, next);
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			stats.Accept();
+			found(entries.index[node.firstAsteroid + i]);
+		}
+		for (int child = node.firstChild + ChildCount(node) - 1; child >= node.firstChild; --child)
+		{
+			stack[top++] = child;
+		}
+	}
+}
+
+// Node waiting on the explicit stack of a traversal, with the square derived on the way down.
+// The square is kept as plain floats, a QuadTreeCell member would zero the whole stack array on every walk.
+struct QuadTreeStackEntry
+{
+	int at;
+	float SWCornerX, SWCornerZ, size;
+	bool inside; // the grown square lies in the frustum, the whole subtree is taken without testing
+};
+
+static QuadTreeStackEntry MakeStackEntry(const int at, const QuadTreeCell& cell, const bool inside)
+{
+	const QuadTreeStackEntry entry = { at, cell.SWCornerX, cell.SWCornerZ, cell.size, inside };
+	return entry;
+}
+
+/**
+ * System for culling the subtree of a node already known to overlap the frustum, see CullAsteroidsSystem
+ * Walks the subtree depth-first with a fixed size stack instead of recursing, children are pushed in reverse
+ * so they are visited in Morton order like the recursive walk did. The 4 child squares of a node are
+ * classified together with SSE and only the occupied children overlapping the frustum are pushed.
+ * Subtrees whose square lies inside the frustum are reported whole, without testing their nodes or items.
+ * @param start the node, its square and whether the square lies inside the frustum
+ */
+template<typename Found, typename Stats>
+static void CullSubtreeSystem(const FrustumQuad& frustum, const QuadTree& quadTree, const QuadTreeStackEntry& start,
+	Found& found, Stats& stats /*OUT*/)
+{
+	const auto& entries = quadTree.entries;
+	QuadTreeStackEntry stack[QUADTREE_STACK_SIZE];
+	int top = 0;
+	stack[top++] = start;
+	while (top > 0)
+	{
+		const QuadTreeStackEntry entry = stack[--top];
+		const QuadTreeCell cell(entry.SWCornerX, entry.SWCornerZ, entry.size);
+		// every disc below the node lies in the grown square, so a square inside the frustum takes the whole subtree
+		if (entry.inside)
+		{
+			AcceptSubtreeSystem(quadTree, entry.at, found, stats);
+			continue;
+		}
 		
-	const float& corner = SWCornerZ - size;
-	const float& otherCorner = SWCornerX + size;
+		const QuadTreeNode& node = quadTree.nodes[entry.at];
+		// test the whole bucket of the node (leaf items or straddling discs) against the frustum
+		const unsigned int count = NodeAsteroidCount(quadTree, node, entry.at);
+		if (count > 0)
+		{
+			const unsigned int first = node.firstAsteroid;
+			stats.Test(count);
+			ScanDiscsInFrustum(&entries.x[first], &entries.z[first], &entries.rds[first], count, frustum.edges,
+				[&](const unsigned int i){ stats.Accept(); found(entries.index[first + i]); });
+		}
+		if (node.firstChild < 0)
+		{
+			continue;
+		}
+		
+		int inside;
+		const int overlapping = ClassifyBoxesInFrustum(frustum, ChildBoxes(cell, NodeReach(quadTree, ChildCell(cell, QUAD_SW))), inside);
+		// only the occupied children exist, they follow each other from firstChild on
+		int child = node.firstChild + ChildCount(node);
+		for (int quadrant = 3; quadrant >= 0; --quadrant)
+		{
+			if (node.childMask & (1 << quadrant))
+			{
+				--child;
+				stats.Visit();
+				if (overlapping & (1 << quadrant))
+				{
+					stack[top++] = MakeStackEntry(child, ChildCell(cell, quadrant), (inside & (1 << quadrant)) != 0);
+				}
+			}
+		}
+	}
+}
+
+/**
+ * System for culling asteroids based on the QuadTree, found(index) is called for every asteroid in the frustum
+ * @param stats QueryStats to count the work of the cull, NoQueryStats to count nothing
+ */
+template<typename Found, typename Stats>
+static void CullAsteroidsSystem(const FrustumQuad& frustum, const QuadTree& quadTree, Found found, Stats& stats /*OUT*/)
+{
+	if (quadTree.nodes.empty() || quadTree.entries.size() == 0)
+	{
+		return;
+	}
 	
-	if(checkDiscRectangleIntersection(SWCornerX, SWCornerZ, otherCorner, corner, x, z, 5.f))
+	// grow the squares by the margin so that discs sticking out of the nodes are not culled,
+	// the root has no siblings and is the only square classified on its own
+	const QuadTreeCell& root = quadTree.root;
+	const float margin = NodeReach(quadTree, root);
+	const float size = root.size + 2.f * margin;
+	const float SWCornerZ = root.SWCornerZ + margin;
+	const float SWCornerX = root.SWCornerX - margin;
+	stats.Visit();
+	const FrustumOverlap overlap = ClassifyBoxInFrustum(frustum, SWCornerX, SWCornerZ - size, SWCornerX + size, SWCornerZ);
+	if (overlap != FrustumOverlap::Outside)
+	{
+		CullSubtreeSystem(frustum, quadTree, MakeStackEntry(0, root, overlap == FrustumOverlap::Inside), found, stats);
+	}
+};
+
+template<typename Found, typename Stats>
+static void CullAsteroidsSystem(const float& x1, const float& z1, const float& x2, const float& z2,
+					  const float& x3, const float& z3, const float& x4, const float& z4, const QuadTree& quadTree, Found found,
+					  Stats& stats /*OUT*/)
+{
+	CullAsteroidsSystem(MakeFrustumQuad(x1, z1, x2, z2, x3, z3, x4, z4), quadTree, found, stats);
+};
+
+template<typename Found>
+static void CullAsteroidsSystem(const float& x1, const float& z1, const float& x2, const float& z2,
+					  const float& x3, const float& z3, const float& x4, const float& z4, const QuadTree& quadTree, Found found)
+{
+	NoQueryStats stats;
+	CullAsteroidsSystem(MakeFrustumQuad(x1, z1, x2, z2, x3, z3, x4, z4), quadTree, found, stats);
+};
+
+// Node waiting on the stack of a multi-frustum walk, with the frustums it still has to be tested against
+struct QuadTreeMultiStackEntry
+{
+	int at;
+	float SWCornerX, SWCornerZ, size; // plain floats like in QuadTreeStackEntry
+	unsigned int active; // bit f is set if the grown square overlaps frustum f
+	unsigned int inside; // bit f is set if the grown square lies in frustum f, the subtree is taken without testing
+};
+
+/**
+ * System for culling asteroids against several frustums in one walk of the QuadTree
+ * Every node on the stack carries the mask of the frustums it overlaps, a frustum drops out of the mask of the
+ * children it misses and the walk stops where no frustum is left. The nodes, buckets and child squares are
+ * loaded once for all the frustums instead of once per cull.
+ * @param frustums frustumCount frustums, culled QUADTREE_MAX_FRUSTUMS at a time
+ * @param visible OUT one list per frustum, visible[f] is cleared and receives the asteroids in frustums[f]
+ */
+static void CullAsteroidsSystem(const FrustumQuad* frustums, const unsigned int frustumCount, const QuadTree& quadTree,
+	vector<unsigned int>* visible /*OUT*/)
+{
+	// the masks hold one bit per frustum, longer lists are culled in walks of QUADTREE_MAX_FRUSTUMS frustums
+	if (frustumCount > QUADTREE_MAX_FRUSTUMS)
 	{
-		const auto& SWChild = node.SWChild;
-		if (SWChild == NULL) // Square is leaf.
+		for (unsigned int first = 0; first < frustumCount; first += QUADTREE_MAX_FRUSTUMS)
 		{
-			const auto& asteroids = node.nodeAsteroids;
-			if(!asteroids.empty())
+			CullAsteroidsSystem(frustums + first, glm::min(frustumCount - first, QUADTREE_MAX_FRUSTUMS), quadTree, visible + first);
+		}
+		return;
+	}
+	
+	for (unsigned int f = 0; f < frustumCount; ++f)
+	{
+		visible[f].clear();
+	}
+	if (quadTree.nodes.empty() || quadTree.entries.size() == 0)
+	{
+		return;
+	}
+	
+	// the root is classified against every frustum on its own, the other squares together with their siblings
+	const QuadTreeCell& root = quadTree.root;
+	const float margin = NodeReach(quadTree, root);
+	const float size = root.size + 2.f * margin;
+	const float SWCornerZ = root.SWCornerZ + margin;
+	const float SWCornerX = root.SWCornerX - margin;
+	unsigned int active = 0, inside = 0;
+	for (unsigned int f = 0; f < frustumCount; ++f)
+	{
+		const FrustumOverlap overlap = ClassifyBoxInFrustum(frustums[f], SWCornerX, SWCornerZ - size, SWCornerX + size, SWCornerZ);
+		active |= (overlap != FrustumOverlap::Outside ? 1u : 0u) << f;
+		inside |= (overlap == FrustumOverlap::Inside ? 1u : 0u) << f;
+	}
+	if (active == 0)
+	{
+		return;
+	}
+	
+	const auto& entries = quadTree.entries;
+	NoQueryStats stats;
+	QuadTreeMultiStackEntry stack[QUADTREE_STACK_SIZE];
+	int top = 0;
+	stack[top++] = { 0, root.SWCornerX, root.SWCornerZ, root.size, active, inside };
+	while (top > 0)
+	{
+		const QuadTreeMultiStackEntry entry = stack[--top];
+		const QuadTreeCell cell(entry.SWCornerX, entry.SWCornerZ, entry.size);
+		
+		// the frustums holding the whole square take the whole subtree and are done with it
+		for (unsigned int f = 0; f < frustumCount; ++f)
+		{
+			if (entry.inside & (1u << f))
 			{
-				al.push_back(asteroids[0]);
+				vector<unsigned int>& list = visible[f];
+				auto accept = [&list](const unsigned int at){ list.push_back(at); };
+				AcceptSubtreeSystem(quadTree, entry.at, accept, stats);
 			}
 		}
-		else
+		const unsigned int testing = entry.active & ~entry.inside;
+		if (testing == 0)
 		{
-			GatherAsteroidSystem(x, z, *SWChild, al);
-			GatherAsteroidSystem(x, z, *node.NWChild, al);
-			GatherAsteroidSystem(x, z, *node.NEChild, al);
-			GatherAsteroidSystem(x, z, *node.SEChild, al);
+			continue;
+		}
+		// once the views have split up, a subtree seen by a single frustum is cheaper to cull on its own
+		if ((testing & (testing - 1)) == 0)
+		{
+			unsigned int f = 0;
+			while (!(testing & (1u << f)))
+			{
+				++f;
+			}
+			vector<unsigned int>& list = visible[f];
+			auto accept = [&list](const unsigned int at){ list.push_back(at); };
+			CullSubtreeSystem(frustums[f], quadTree, MakeStackEntry(entry.at, cell, false), accept, stats);
+			continue;
+		}
+		
+		const QuadTreeNode& node = quadTree.nodes[entry.at];
+		// test the whole bucket of the node against every frustum overlapping it
+		const unsigned int asteroidCount = NodeAsteroidCount(quadTree, node, entry.at);
+		if (asteroidCount > 0)
+		{
+			const unsigned int first = node.firstAsteroid;
+			for (unsigned int f = 0; f < frustumCount; ++f)
+			{
+				if (testing & (1u << f))
+				{
+					vector<unsigned int>& list = visible[f];
+					ScanDiscsInFrustum(&entries.x[first], &entries.z[first], &entries.rds[first], asteroidCount, frustums[f].edges,
+						[&](const unsigned int i){ list.push_back(entries.index[first + i]); });
+				}
+			}
+		}
+		if (node.firstChild < 0)
+		{
+			continue;
+		}
+		
+		// the child squares are derived once and classified against every frustum still testing,
+		// the lanes of each classification are scattered into the frustum masks of the children
+		const BoxLanes boxes = ChildBoxes(cell, NodeReach(quadTree, ChildCell(cell, QUAD_SW)));
+		unsigned int childActive[4] = { 0, 0, 0, 0 };
+		unsigned int childInside[4] = { 0, 0, 0, 0 };
+		for (unsigned int f = 0; f < frustumCount; ++f)
+		{
+			if (testing & (1u << f))
+			{
+				int insideLanes;
+				const int overlapping = ClassifyBoxesInFrustum(frustums[f], boxes, insideLanes);
+				for (int quadrant = 0; quadrant < 4; ++quadrant)
+				{
+					childActive[quadrant] |= ((overlapping >> quadrant) & 1u) << f;
+					childInside[quadrant] |= ((insideLanes >> quadrant) & 1u) << f;
+				}
+			}
+		}
+		
+		// only the occupied children exist, they follow each other from firstChild on
+		int child = node.firstChild + ChildCount(node);
+		for (int quadrant = 3; quadrant >= 0; --quadrant)
+		{
+			if (node.childMask & (1 << quadrant))
+			{
+				--child;
+				if (childActive[quadrant] != 0)
+				{
+					const QuadTreeCell childCell = ChildCell(cell, quadrant);
+					stack[top++] = { child, childCell.SWCornerX, childCell.SWCornerZ, childCell.size,
+						childActive[quadrant], childInside[quadrant] };
+				}
+			}
 		}
 	}
 };
 
 /**
- * System for Drawing asteroids based on the QuadTree
+ * System for bulk loading the QuadTree from Morton keys
+ * The asteroid centres are quantized inside the root square and radix sorted once, after that the
+ * asteroids of every node are a contiguous range of the sorted keys and the children ranges are found
+ * with a binary search on the next 2 bit digit. Each asteroid is stored in the leaf holding its centre,
+ * the queries make up for the disc overhang through QuadTree::boundsMargin.
  */
-static void DrawAsteroidsSystem(const float& x1, const float& z1, const float& x2, const float& z2,  // Routine to draw all the asteroids in the  
-					  const float& x3, const float& z3, const float& x4, const float& z4, const QuadTreeNode& node)
+static void MortonBuildSystem(QuadTree& quadTree)
 {
-	const float& size = node.size; 
-	const float& SWCornerZ = node.SWCornerZ;
-	const float& SWCornerX = node.SWCornerX;
+	auto& nodes = quadTree.nodes;
+	auto& buckets = quadTree.buckets;
+	auto& buildAsteroids = quadTree.buildAsteroids;
+	const auto& globalAsteroids = quadTree.arrayAsteroids;
+	const unsigned int length = quadTree.length;
+	
+	const QuadTreeCell& root = quadTree.root;
+	const float SWCornerX = root.SWCornerX;
+	const float SWCornerZ = root.SWCornerZ;
+	const float scale = MORTON_CELLS / root.size;
+	const float maxCell = static_cast<float>(MORTON_CELLS - 1);
+	
+	vector<unsigned int> keys, order, keyScratch, orderScratch;
+	keys.reserve(length);
+	order.reserve(length);
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		if (globalAsteroids.rds[i] > 0.f)
+		{
+			const float cellX = glm::clamp((globalAsteroids.x[i] - SWCornerX) * scale, 0.f, maxCell);
+			const float cellZ = glm::clamp((SWCornerZ - globalAsteroids.z[i]) * scale, 0.f, maxCell);
+			keys.push_back(MortonEncode(static_cast<unsigned int>(cellX), static_cast<unsigned int>(cellZ)));
+			order.push_back(i);
+		}
+	}
+	RadixSortSystem(keys, order, keyScratch, orderScratch);
+	
+	// a disc sticks out of its leaf by its radius, or further if the clamping put a centre outside the root into an edge leaf
+	float margin = 0.f;
+	const unsigned int count = static_cast<unsigned int>(keys.size());
+	buildAsteroids.resize(count);
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		const unsigned int at = order[i];
+		const Location loc = { globalAsteroids.x[at], globalAsteroids.y[at], globalAsteroids.z[at], globalAsteroids.rds[at], at };
+		buildAsteroids[i] = loc;
+		margin = glm::max(margin, glm::max(loc.rds, DiscOverhang(root, loc.x, loc.z, loc.rds)));
+	}
+	quadTree.boundsMargin = margin;
+	
+	const QuadTreeSplitPolicy policy = MakeSplitPolicy(quadTree);
+	
+	// Morton prefix and level of every node, indexed the same way as the nodes
+	vector<unsigned int> prefixes(1, 0u);
+	vector<unsigned int> levels(1, 0u);
+	buckets[0].firstAsteroid = 0;
+	buckets[0].asteroidCount = count;
+	
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		const QuadTreeBucket bucket = buckets[i];
+		const unsigned int level = levels[i];
+		if (bucket.asteroidCount <= policy.leafCapacity)
+		{
+			continue; // leaf, keeps its range
+		}
+		if (level == MORTON_BITS || ldexp(root.size, -static_cast<int>(level + 1)) < policy.minChildSize)
+		{
+			++quadTree.limitedLeaves;
+			continue;
+		}
+		
+		const unsigned int shift = 2 * (MORTON_BITS - 1 - level);
+		
+		const int firstChild = static_cast<int>(nodes.size());
+		unsigned char childMask = 0;
 		
-	const float& corner = SWCornerZ - size;
-	const float& otherCorner = SWCornerX + size;
-	
-	const auto& nodeAsteroids = node.nodeAsteroids;
-	const auto& SWChild = node.SWChild;
-	 // If the square does not intersect the frustum do nothing.
-   if ( checkQuadrilateralsIntersection(x1, z1, x2, z2, x3, z3, x4, z4,
-								        SWCornerX, SWCornerZ, SWCornerX, corner,
-								        otherCorner, corner, otherCorner, SWCornerZ) )
-   {
-      if (SWChild == NULL) // Square is leaf.
-	  {
-		 if(!nodeAsteroids.empty())
-		 {
-			drawAsteroid(nodeAsteroids[0].index);
-		 }
-         return;
-	  }
-	  DrawAsteroidsSystem(x1, z1, x2, z2, x3, z3, x4, z4, *SWChild);
-	  DrawAsteroidsSystem(x1, z1, x2, z2, x3, z3, x4, z4, *node.NWChild);
-	  DrawAsteroidsSystem(x1, z1, x2, z2, x3, z3, x4, z4, *node.NEChild);
-	  DrawAsteroidsSystem(x1, z1, x2, z2, x3, z3, x4, z4, *node.SEChild); 
-   }
-};																						
-
-static void QuadTreeInitializeSystem(const float x, const float z, const float s, QuadTree& quadTree)
-{
-	quadTree.header = QuadTreeNode(x, z, s);
-	vector<Location> asteroidData;
+		unsigned int begin = bucket.firstAsteroid;
+		const unsigned int end = bucket.firstAsteroid + bucket.asteroidCount;
+		for (unsigned int c = 0; c < 4; ++c)
+		{
+			const unsigned int prefix = prefixes[i] | (c << shift);
+			const unsigned int childEnd = c == 3 ? end : static_cast<unsigned int>(
+				lower_bound(keys.begin() + begin, keys.begin() + end, prefix + (1u << shift)) - keys.begin());
+			
+			if (childEnd > begin) // empty quadrants are never materialized
+			{
+				QuadTreeBucket childBucket;
+				childBucket.firstAsteroid = begin;
+				childBucket.asteroidCount = childEnd - begin;
+				nodes.push_back(QuadTreeNode());
+				buckets.push_back(childBucket);
+				prefixes.push_back(prefix);
+				levels.push_back(level + 1);
+				childMask |= 1 << c;
+			}
+			begin = childEnd;
+		}
+		nodes[i].firstChild = firstChild;
+		nodes[i].childMask = childMask;
+		buckets[i].asteroidCount = 0;
+	}
+}
+
+/**
+ * System for dropping the whole tree in O(1)
+ * The memory is kept, so building the tree again does not allocate unless it got bigger.
+ */
+static void QuadTreeResetSystem(QuadTree& quadTree)
+{
+	quadTree.nodes.Reset();
+	quadTree.buckets.Reset();
+	quadTree.buildAsteroids.clear();
+	quadTree.boundsMargin = 0.f;
+	quadTree.limitedLeaves = 0;
+	quadTree.buildMilliseconds = 0.f;
+	quadTree.garbageNodes = quadTree.garbageEntries = 0;
+	quadTree.packedEntries = false;
+	
+	auto& entries = quadTree.entries;
+	entries.x.clear(); entries.y.clear(); entries.z.clear(); entries.rds.clear();
+	entries.index.clear();
+}
+
+/**
+ * System for moving the built asteroid order into the SoA columns the queries scan
+ * @param pool splits the passes over the asteroids and nodes among its threads, nullptr runs them on the calling thread
+ */
+static void TransposeEntriesSystem(QuadTree& quadTree, TaskPool* pool = nullptr)
+{
+	const auto& buildAsteroids = quadTree.buildAsteroids;
+	auto& entries = quadTree.entries;
+	const size_t count = buildAsteroids.size();
+	const auto forRange = [pool](const size_t n, const function<void(size_t, size_t)>& body)
+	{
+		if (pool == nullptr)
+		{
+			body(0, n);
+			return;
+		}
+		ParallelFor(*pool, n, ParallelChunkCount(*pool, n, PARALLEL_BUILD_MIN_TASK_ASTEROIDS),
+			[&body](const size_t, const size_t begin, const size_t end){ body(begin, end); });
+	};
+	
+	// padding lets the SIMD scans load a full register at the end of the last bucket
+	entries.x.resize(count + SIMD_WIDTH - 1, 0.f);
+	entries.y.resize(count + SIMD_WIDTH - 1, 0.f);
+	entries.z.resize(count + SIMD_WIDTH - 1, 0.f);
+	entries.rds.resize(count + SIMD_WIDTH - 1, 0.f);
+	entries.index.resize(count);
+	auto& entrySlots = quadTree.entrySlots;
+	entrySlots.assign(quadTree.length, QUADTREE_NO_ENTRY);
+	forRange(count, [&](const size_t begin, const size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			const Location& loc = buildAsteroids[i];
+			entries.x[i] = loc.x;
+			entries.y[i] = loc.y;
+			entries.z[i] = loc.z;
+			entries.rds[i] = loc.rds;
+			entries.index[i] = loc.index;
+			entrySlots[loc.index] = static_cast<unsigned int>(i); // every asteroid is stored once, no two slots collide
+		}
+	});
+	
+	// builds pack the buckets, the incremental changes start from there
+	auto& nodes = quadTree.nodes;
+	auto& buckets = quadTree.buckets;
+	forRange(nodes.size(), [&](const size_t begin, const size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			buckets[i].asteroidCapacity = buckets[i].asteroidCount;
+			InlineBucket(nodes[i], buckets[i]);
+		}
+	});
+	quadTree.packedEntries = true;
+}
+
+/**
+ * System for (re)building the QuadTree over the first length asteroids of arrayAsteroids
+ * Recursive is the default, it builds fastest.
+ */
+static void QuadTreeInitializeSystem(const float x, const float z, const float s, QuadTree& quadTree,
+	const QuadTreeBuildMode mode = QuadTreeBuildMode::Recursive)
+{
+	const auto buildStart = chrono::steady_clock::now();
+	const auto buildTime = [&buildStart]()
+	{
+		return chrono::duration<float, milli>(chrono::steady_clock::now() - buildStart).count();
+	};
+	
+	QuadTreeResetSystem(quadTree);
+	quadTree.root = QuadTreeCell(x, z, s);
+	quadTree.nodes.push_back(QuadTreeNode());
+	quadTree.buckets.push_back(QuadTreeBucket());
+	
+	// the Morton keys only place discs by their centre, loose trees also place them by radius
+	if (mode == QuadTreeBuildMode::Morton && LooseMargin(quadTree) == 0.f)
+	{
+		MortonBuildSystem(quadTree);
+		TransposeEntriesSystem(quadTree);
+		quadTree.buildMilliseconds = buildTime();
+		return;
+	}
+	
+	if (mode == QuadTreeBuildMode::Parallel)
+	{
+		if (!quadTree.parallelBuild)
+		{
+			quadTree.parallelBuild.reset(new QuadTreeParallelBuild());
+		}
+		QuadTreeParallelBuild& build = *quadTree.parallelBuild;
+		quadTree.boundsMargin = ParallelGatherSystem(build.pool, quadTree);
+		quadTree.buckets[0].asteroidCount = static_cast<unsigned int>(quadTree.buildAsteroids.size());
+		quadTree.limitedLeaves = ParallelBuildSystem(build, quadTree.nodes, quadTree.buckets, quadTree.root,
+			quadTree.buildAsteroids, MakeSplitPolicy(quadTree));
+		TransposeEntriesSystem(quadTree, &build.pool);
+		quadTree.buildMilliseconds = buildTime();
+		return;
+	}
+	
+	auto& buildAsteroids = quadTree.buildAsteroids;
 	const unsigned int& length = quadTree.length;
 	const auto& globalAsteroids = quadTree.arrayAsteroids;
-	asteroidData.resize(length); // preallocate to not waste time resizing
+	buildAsteroids.reserve(length); // preallocate to not waste time resizing
 	
 	// grab the necessary data instead of copying over everything
+	float overhang = 0.f;
 	for(unsigned int i = 0; i < length; ++i)
 	{
-		asteroidData[i] = { globalAsteroids.x[i], globalAsteroids.y[i], globalAsteroids.z[i], globalAsteroids.rds[i], i };
+		const float& radius = globalAsteroids.rds[i];
+		if (radius > 0.f)
+		{
+			const float& c_x = globalAsteroids.x[i];
+			const float& c_z = globalAsteroids.z[i];
+			buildAsteroids.push_back({ c_x, globalAsteroids.y[i], c_z, radius, i });
+			
+			// discs are kept inside the node that contains them, only the root can be too small
+			overhang = glm::max(overhang, DiscOverhang(quadTree.root, c_x, c_z, radius));
+		}
+	}
+	quadTree.boundsMargin = overhang;
+	quadTree.buckets[0].asteroidCount = static_cast<unsigned int>(buildAsteroids.size());
+	
+	quadTree.limitedLeaves = BuildSystem(quadTree.nodes, quadTree.buckets, quadTree.root, buildAsteroids, MakeSplitPolicy(quadTree));
+	TransposeEntriesSystem(quadTree);
+	quadTree.buildMilliseconds = buildTime();
+}
+
+static void SpatialIndexBuildSystem(QuadTree& quadTree, const float x, const float z, const float s,
+	const Asteroids& asteroids, const unsigned int length)
+{
+	if (&asteroids != &quadTree.arrayAsteroids)
+	{
+		quadTree.arrayAsteroids = asteroids;
 	}
-	quadTree.header.asteroidLocations = asteroidData;
-	BuildSystem(quadTree.header);
-}
\ No newline at end of file
+	quadTree.length = length;
+	QuadTreeInitializeSystem(x, z, s, quadTree);
+}
+
+static const char* SpatialIndexName(const QuadTree&) { return "quadtree"; }
@@ -0,0 +1,941 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include "Bvh.h"
+#include "KdTree.h"
+#include "Octree.h"
+#include "QuadTree.h"
+#include "QuadTreeStats.h"
+#include "QuadTreeUpdate.h"
+#include "UniformGrid.h"
+
+// Headless benchmarks of the QuadTree, started with the -benchmark command line argument.
+// Every benchmark runs on the same Asteroids input the app would use and prints the average time.
+
+using namespace std;
+
+constexpr auto BENCHMARK_RUNS = 20; // number of times each measurement is repeated
+constexpr auto QUERY_STEPS = 100; // the query benchmarks sample the root square on a QUERY_STEPS^2 lattice
+constexpr auto QUERY_SWEEP_POINTS = QUERY_STEPS * QUERY_STEPS;
+constexpr auto CULL_STEPS = 20; // the cull benchmark places the craft on a CULL_STEPS^2 lattice
+constexpr auto CULL_ANGLES = 8; // and turns it to this many directions at every point
+constexpr auto VALIDATION_STEPS = 20; // the spatial index check compares (VALIDATION_STEPS + 2)^2 queries of each kind with brute force
+constexpr float UPDATE_STEP = 2.f; // distance an asteroid drifts along x and z in one incremental update
+constexpr auto BENCHMARK_CLUSTERS = 16; // the clustered field gathers all asteroids around this many points
+constexpr float BENCHMARK_CLUSTER_SPREAD = 60.f; // how far an asteroid may sit from the centre of its cluster
+constexpr auto BENCHMARK_LARGE_EVERY = 50; // the mixed size field makes every 50th asteroid a large one
+constexpr float BENCHMARK_LARGE_RADIUS = 30.f; // the others get a radius between 1 and 5
+
+using BenchmarkClock = chrono::high_resolution_clock;
+
+static double ElapsedMilliseconds(const BenchmarkClock::time_point& start)
+{
+	return chrono::duration<double, milli>(BenchmarkClock::now() - start).count();
+}
+
+// Frustum quadrilateral of the craft at (x,z) turned by angle degrees, the one of the right viewport
+// unless a longer reach makes it a wide view over a large part of the field
+static void CraftFrustum(const float x, const float z, const float angle, float (&quad)[8] /*OUT*/, const float reach = 353.6f)
+{
+	const float sinAngleDeg = sin((PI / 180.f) * (45.f + angle));
+	const float zCosAngleDeg = cos((PI / 180.f) * (45.f + angle));
+	const float xSinAngleDeg = sin((PI / 180.f) * (45.f - angle));
+	const float cosAngleDeg = cos((PI / 180.f) * (45.f - angle));
+	const float corners[8] = {
+		x - 7.072f * sinAngleDeg, z - 7.072f * zCosAngleDeg,
+		x - reach * sinAngleDeg, z - reach * zCosAngleDeg,
+		x + reach * xSinAngleDeg, z - reach * cosAngleDeg,
+		x + 7.072f * xSinAngleDeg, z - 7.072f * cosAngleDeg };
+	copy(corners, corners + 8, quad);
+}
+
+// 3D view frustum of the craft at (x,0,z) turned by angle degrees, CraftFrustum is its shadow on the field
+static FrustumPlanes CraftFrustumPlanes(const float x, const float z, const float angle)
+{
+	const float sinAngle = sin((PI / 180.f) * angle);
+	const float cosAngle = cos((PI / 180.f) * angle);
+	return MakeFrustumPlanes(glm::vec3(x, 0.f, z), glm::vec3(-sinAngle, 0.f, -cosAngle), glm::vec3(0.f, 1.f, 0.f),
+		VIEW_TAN_HALF_ANGLE, VIEW_NEAR, VIEW_FAR);
+}
+
+/**
+ * System for timing how long it takes to build the QuadTree with the given mode
+ * @return average build time in milliseconds
+ */
+static double BenchmarkBuildSystem(QuadTree& quadTree, const QuadTreeBuildMode mode)
+{
+	const QuadTreeCell root = quadTree.root;
+	
+	const auto start = BenchmarkClock::now();
+	for (int i = 0; i < BENCHMARK_RUNS; ++i)
+	{
+		QuadTreeInitializeSystem(root.SWCornerX, root.SWCornerZ, root.size, quadTree, mode);
+	}
+	return ElapsedMilliseconds(start) / BENCHMARK_RUNS;
+}
+
+/**
+ * System for timing the Parallel build with 1, 2, 4... threads up to the cores of the machine
+ * Prints the speedup of every thread count over the Recursive build of the same field.
+ */
+static void ParallelScalingSystem(QuadTree& quadTree)
+{
+	const unsigned int cores = glm::max(1u, thread::hardware_concurrency());
+	const double recursive = BenchmarkBuildSystem(quadTree, QuadTreeBuildMode::Recursive);
+	cout << "Parallel build scaling (recursive " << recursive << " ms, " << cores << " cores):" << endl;
+	for (unsigned int threads = 1; ; threads = glm::min(2 * threads, cores))
+	{
+		quadTree.parallelBuild.reset(new QuadTreeParallelBuild(threads));
+		const double parallel = BenchmarkBuildSystem(quadTree, QuadTreeBuildMode::Parallel);
+		cout << "  " << threads << " threads: " << parallel << " ms, speedup " << recursive / parallel << endl;
+		if (threads == cores)
+		{
+			break;
+		}
+	}
+	quadTree.parallelBuild.reset(); // the next Parallel build starts a pool with all the cores again
+}
+
+/**
+ * System for timing collision queries on a lattice of points covering the given square
+ * @param index any structure with a GatherAsteroidSystem overload
+ * @return average time of a full sweep of queries in milliseconds
+ */
+template<typename SpatialIndex>
+static double BenchmarkGatherSystem(const SpatialIndex& index, const QuadTreeCell& area)
+{
+	const float step = area.size / QUERY_STEPS;
+	
+	vector<Location> al;
+	size_t found = 0;
+	const auto start = BenchmarkClock::now();
+	for (int run = 0; run < BENCHMARK_RUNS; ++run)
+	{
+		for (int i = 0; i < QUERY_STEPS; ++i)
+		{
+			for (int j = 0; j < QUERY_STEPS; ++j)
+			{
+				al.clear();
+				GatherAsteroidSystem(area.SWCornerX + i * step, area.SWCornerZ - j * step, 7.072f, index, al);
+				found += al.size();
+			}
+		}
+	}
+	if (found == 0)
+	{
+		cout << "  (no asteroid found by the queries)" << endl;
+	}
+	return ElapsedMilliseconds(start) / BENCHMARK_RUNS;
+}
+
+/**
+ * System for timing frustum culls of the craft on a lattice of points covering the given square
+ * @param index any structure with a CullAsteroidsSystem overload
+ * @return average time of a full sweep of culls in milliseconds
+ */
+template<typename SpatialIndex>
+static double BenchmarkCullSystem(const SpatialIndex& index, const QuadTreeCell& area)
+{
+	const float step = area.size / CULL_STEPS;
+	
+	size_t found = 0;
+	float quad[8];
+	const auto start = BenchmarkClock::now();
+	for (int run = 0; run < BENCHMARK_RUNS; ++run)
+	{
+		for (int i = 0; i < CULL_STEPS; ++i)
+		{
+			for (int j = 0; j < CULL_STEPS; ++j)
+			{
+				for (int a = 0; a < CULL_ANGLES; ++a)
+				{
+					CraftFrustum(area.SWCornerX + i * step, area.SWCornerZ - j * step, a * 360.f / CULL_ANGLES, quad);
+					CullAsteroidsSystem(quad[0], quad[1], quad[2], quad[3], quad[4], quad[5], quad[6], quad[7], index,
+						[&found](const unsigned int){ ++found; });
+				}
+			}
+		}
+	}
+	if (found == 0)
+	{
+		cout << "  (no asteroid found by the culls)" << endl;
+	}
+	return ElapsedMilliseconds(start) / BENCHMARK_RUNS;
+}
+
+/**
+ * System checking a spatial index against brute force on a lattice of queries
+ * Every asteroid centred in a frustum has to be culled in exactly once and every asteroid touching a
+ * collision disc has to be gathered. The lattice reaches one step out of the area on every side, and every
+ * asteroid centred outside the area is also looked for with a small gather at its own centre, so discs the index
+ * stores beyond its square are checked too.
+ * @return number of wrong results
+ */
+template<typename SpatialIndex>
+static unsigned int ValidateSpatialIndexSystem(const SpatialIndex& index, const Asteroids& asteroids,
+	const unsigned int length, const QuadTreeCell& area)
+{
+	unsigned int errors = 0;
+	vector<unsigned char> seen(length);
+	vector<Location> al;
+	float quad[8];
+	const auto cull = [&](const float x, const float z, const float angle)
+	{
+		fill(seen.begin(), seen.end(), 0);
+		CraftFrustum(x, z, angle, quad);
+		CullAsteroidsSystem(quad[0], quad[1], quad[2], quad[3], quad[4], quad[5], quad[6], quad[7], index,
+			[&](const unsigned int at){ errors += seen[at]++ > 0; });
+		for (unsigned int a = 0; a < length; ++a)
+		{
+			errors += asteroids.rds[a] > 0.f && seen[a] == 0 &&
+				checkPointInQuadrilateral(quad[0], quad[1], quad[2], quad[3], quad[4], quad[5], quad[6], quad[7], asteroids.x[a], asteroids.z[a]);
+		}
+	};
+	const auto gather = [&](const float x, const float z, const float r)
+	{
+		fill(seen.begin(), seen.end(), 0);
+		al.clear();
+		GatherAsteroidSystem(x, z, r, index, al);
+		for (const Location& loc : al)
+		{
+			seen[loc.index] = 1;
+		}
+		for (unsigned int a = 0; a < length; ++a)
+		{
+			const float dx = asteroids.x[a] - x, dz = asteroids.z[a] - z, reach = r + asteroids.rds[a];
+			errors += asteroids.rds[a] > 0.f && seen[a] == 0 && dx * dx + dz * dz <= reach * reach;
+		}
+	};
+	
+	const float step = area.size / VALIDATION_STEPS;
+	for (int i = -1; i <= VALIDATION_STEPS; ++i)
+	{
+		for (int j = -1; j <= VALIDATION_STEPS; ++j)
+		{
+			const float x = area.SWCornerX + (i + 0.5f) * step;
+			const float z = area.SWCornerZ - (j + 0.5f) * step;
+			cull(x, z, ((i + 1) * (VALIDATION_STEPS + 2) + j + 1) * 37.f);
+			gather(x, z, 7.072f);
+		}
+	}
+	for (unsigned int a = 0; a < length; ++a)
+	{
+		const float x = asteroids.x[a], z = asteroids.z[a];
+		if (asteroids.rds[a] > 0.f && (x < area.SWCornerX || x > area.SWCornerX + area.size ||
+			z > area.SWCornerZ || z < area.SWCornerZ - area.size))
+		{
+			gather(x, z, 0.5f); // a small disc only finds it if the node squares are grown far enough
+		}
+	}
+	return errors;
+}
+
+/**
+ * System for building one spatial index backend and printing its build, query and cull times
+ * All the backends run the same queries on the same asteroids, so their times compare directly.
+ */
+template<typename SpatialIndex>
+static void BenchmarkSpatialIndexSystem(SpatialIndex& index, const Asteroids& asteroids, const unsigned int length,
+	const QuadTreeCell& area)
+{
+	const auto start = BenchmarkClock::now();
+	for (int run = 0; run < BENCHMARK_RUNS; ++run)
+	{
+		SpatialIndexBuildSystem(index, area.SWCornerX, area.SWCornerZ, area.size, asteroids, length);
+	}
+	const double build = ElapsedMilliseconds(start) / BENCHMARK_RUNS;
+	
+	cout << "  " << SpatialIndexName(index) << ": build " << build << " ms"
+		<< ", queries " << BenchmarkGatherSystem(index, area) << " ms"
+		<< ", culls " << BenchmarkCullSystem(index, area) << " ms";
+	const unsigned int errors = ValidateSpatialIndexSystem(index, asteroids, length, area);
+	if (errors > 0)
+	{
+		cout << ", " << errors << " WRONG RESULTS";
+	}
+	cout << endl;
+}
+
+// Node laid out with its square stored in it, as the QuadTree nodes were before the bounds became implicit
+struct StoredBoundsNode
+{
+	QuadTreeCell cell;
+	QuadTreeNode node;
+};
+
+// Copy of the nodes of a built QuadTree in the stored bounds layout, the buckets and entries are read from the tree
+struct StoredBoundsQuadTree
+{
+	StoredBoundsQuadTree(){quadTree = nullptr;}
+	
+	const QuadTree* quadTree;
+	vector<StoredBoundsNode> nodes;
+};
+
+// Every parent comes before its children in QuadTree::nodes, so the squares are filled in with one pass
+static void StoredBoundsBuildSystem(const QuadTree& quadTree, StoredBoundsQuadTree& stored)
+{
+	stored.quadTree = &quadTree;
+	stored.nodes.assign(quadTree.nodes.size(), StoredBoundsNode());
+	stored.nodes[0].cell = quadTree.root;
+	for (size_t i = 0; i < quadTree.nodes.size(); ++i)
+	{
+		const QuadTreeNode& node = quadTree.nodes[i];
+		stored.nodes[i].node = node;
+		int child = node.firstChild;
+		for (int quadrant = 0; quadrant < 4; ++quadrant)
+		{
+			if (node.childMask & (1 << quadrant))
+			{
+				stored.nodes[child++].cell = ChildCell(stored.nodes[i].cell, quadrant);
+			}
+		}
+	}
+}
+
+// GatherAsteroidNodeSystem reading the square of every node from memory
+static void GatherAsteroidNodeSystem(const float& x, const float& z, const float& r, const StoredBoundsQuadTree& stored,
+	const int at, vector<Location>& al /*OUT*/)
+{
+	const QuadTree& quadTree = *stored.quadTree;
+	const StoredBoundsNode& storedNode = stored.nodes[at];
+	const QuadTreeCell& cell = storedNode.cell;
+	const float reach = NodeReach(quadTree, cell);
+	if (checkDiscRectangleIntersection(cell.SWCornerX - reach, cell.SWCornerZ + reach,
+		cell.SWCornerX + cell.size + reach, cell.SWCornerZ - cell.size - reach, x, z, r))
+	{
+		const QuadTreeNode& node = storedNode.node;
+		const unsigned int count = NodeAsteroidCount(quadTree, node, at);
+		if (count > 0)
+		{
+			const auto& entries = quadTree.entries;
+			const unsigned int first = node.firstAsteroid;
+			ScanDiscsNearPoint(&entries.x[first], &entries.z[first], &entries.rds[first], count, x, z, r,
+				[&](const unsigned int i){ al.push_back(entries.at(first + i)); });
+		}
+		
+		int child = node.firstChild;
+		for (unsigned int mask = node.childMask; mask != 0; mask &= mask - 1)
+		{
+			GatherAsteroidNodeSystem(x, z, r, stored, child++, al);
+		}
+	}
+}
+
+static void GatherAsteroidSystem(const float& x, const float& z, const float& r, const StoredBoundsQuadTree& stored,
+	vector<Location>& al /*OUT*/)
+{
+	if (!stored.nodes.empty() && stored.quadTree->entries.size() > 0)
+	{
+		GatherAsteroidNodeSystem(x, z, r, stored, 0, al);
+	}
+}
+
+// CullAsteroidsNodeSystem reading the square of every node from memory
+template<typename Found>
+static void CullAsteroidsNodeSystem(const FrustumQuad& frustum, const StoredBoundsQuadTree& stored, const int at, Found& found)
+{
+	const QuadTree& quadTree = *stored.quadTree;
+	const StoredBoundsNode& storedNode = stored.nodes[at];
+	const QuadTreeCell& cell = storedNode.cell;
+	const float margin = NodeReach(quadTree, cell);
+	const float minX = cell.SWCornerX - margin, maxX = cell.SWCornerX + cell.size + margin;
+	const float minZ = cell.SWCornerZ - cell.size - margin, maxZ = cell.SWCornerZ + margin;
+	if (ClassifyBoxInFrustum(frustum, minX, minZ, maxX, maxZ) == FrustumOverlap::Outside)
+	{
+		return;
+	}
+	
+	const QuadTreeNode& node = storedNode.node;
+	const unsigned int count = NodeAsteroidCount(quadTree, node, at);
+	if (count > 0)
+	{
+		const auto& entries = quadTree.entries;
+		const unsigned int first = node.firstAsteroid;
+		ScanDiscsInFrustum(&entries.x[first], &entries.z[first], &entries.rds[first], count, frustum.edges,
+			[&](const unsigned int i){ found(entries.index[first + i]); });
+	}
+	
+	int child = node.firstChild;
+	for (unsigned int mask = node.childMask; mask != 0; mask &= mask - 1)
+	{
+		CullAsteroidsNodeSystem(frustum, stored, child++, found);
+	}
+}
+
+template<typename Found>
+static void CullAsteroidsSystem(const float& x1, const float& z1, const float& x2, const float& z2,
+	const float& x3, const float& z3, const float& x4, const float& z4, const StoredBoundsQuadTree& stored, Found found)
+{
+	if (!stored.nodes.empty() && stored.quadTree->entries.size() > 0)
+	{
+		CullAsteroidsNodeSystem(MakeFrustumQuad(x1, z1, x2, z2, x3, z3, x4, z4), stored, 0, found);
+	}
+}
+
+/**
+ * System comparing the traversals deriving the node squares while descending with ones reading them from the nodes
+ * Both walk the same tree and scan the same buckets, only the node array differs.
+ */
+static void NodeLayoutSystem(const QuadTree& quadTree)
+{
+	const QuadTreeCell root = quadTree.root;
+	StoredBoundsQuadTree stored;
+	StoredBoundsBuildSystem(quadTree, stored);
+	
+	cout << "Node layout (" << quadTree.nodes.size() << " nodes, " << QUERY_SWEEP_POINTS << " collision queries, "
+		<< CULL_STEPS * CULL_STEPS * CULL_ANGLES << " frustum culls):" << endl;
+	cout << "  implicit bounds: " << sizeof(QuadTreeNode) << " bytes per node"
+		<< ", queries " << BenchmarkGatherSystem(quadTree, root) << " ms"
+		<< ", culls " << BenchmarkCullSystem(quadTree, root) << " ms" << endl;
+	cout << "  stored bounds: " << sizeof(StoredBoundsNode) << " bytes per node"
+		<< ", queries " << BenchmarkGatherSystem(stored, root) << " ms"
+		<< ", culls " << BenchmarkCullSystem(stored, root) << " ms";
+	const unsigned int errors = ValidateSpatialIndexSystem(stored, quadTree.arrayAsteroids, quadTree.length, root);
+	if (errors > 0)
+	{
+		cout << ", " << errors << " WRONG RESULTS";
+	}
+	cout << endl;
+}
+
+/**
+ * System printing the shape of the default tree and how much work its queries do
+ * The counted queries run over the same lattices as BenchmarkGatherSystem and BenchmarkCullSystem.
+ */
+static void StatisticsSystem(const QuadTree& quadTree)
+{
+	const QuadTreeCell& area = quadTree.root;
+	cout << "Statistics:" << endl;
+	PrintQuadTreeStatsSystem(QuadTreeStatsSystem(quadTree));
+	
+	QueryStats gather;
+	vector<Location> al;
+	const float queryStep = area.size / QUERY_STEPS;
+	for (int i = 0; i < QUERY_STEPS; ++i)
+	{
+		for (int j = 0; j < QUERY_STEPS; ++j)
+		{
+			al.clear();
+			GatherAsteroidSystem(area.SWCornerX + i * queryStep, area.SWCornerZ - j * queryStep, 7.072f, quadTree, al, gather);
+		}
+	}
+	PrintQueryStatsSystem("collision queries", gather, QUERY_SWEEP_POINTS);
+	
+	QueryStats cull;
+	float quad[8];
+	const float cullStep = area.size / CULL_STEPS;
+	for (int i = 0; i < CULL_STEPS; ++i)
+	{
+		for (int j = 0; j < CULL_STEPS; ++j)
+		{
+			for (int a = 0; a < CULL_ANGLES; ++a)
+			{
+				CraftFrustum(area.SWCornerX + i * cullStep, area.SWCornerZ - j * cullStep, a * 360.f / CULL_ANGLES, quad);
+				CullAsteroidsSystem(quad[0], quad[1], quad[2], quad[3], quad[4], quad[5], quad[6], quad[7], quadTree,
+					[](const unsigned int){}, cull);
+			}
+		}
+	}
+	PrintQueryStatsSystem("frustum culls", cull, CULL_STEPS * CULL_STEPS * CULL_ANGLES);
+	
+	// frustums reaching across the whole field hold large subtrees, those are taken without testing
+	QueryStats wide;
+	for (int i = 0; i < CULL_STEPS; ++i)
+	{
+		for (int j = 0; j < CULL_STEPS; ++j)
+		{
+			for (int a = 0; a < CULL_ANGLES; ++a)
+			{
+				CraftFrustum(area.SWCornerX + i * cullStep, area.SWCornerZ - j * cullStep, a * 360.f / CULL_ANGLES, quad, area.size);
+				CullAsteroidsSystem(quad[0], quad[1], quad[2], quad[3], quad[4], quad[5], quad[6], quad[7], quadTree,
+					[](const unsigned int){}, wide);
+			}
+		}
+	}
+	PrintQueryStatsSystem("wide frustum culls", wide, CULL_STEPS * CULL_STEPS * CULL_ANGLES);
+}
+
+/**
+ * System timing the node test of the culls on its own
+ * Every node box of the tree is tested against every frustum of the cull lattice, once with the
+ * 16 segment quadrilateral check and once with the separating axis test, and the answers are compared.
+ */
+static void NodeTestSystem(const QuadTree& quadTree)
+{
+	StoredBoundsQuadTree stored;
+	StoredBoundsBuildSystem(quadTree, stored);
+	vector<float> minX, minZ, maxX, maxZ;
+	for (const StoredBoundsNode& node : stored.nodes)
+	{
+		const float margin = NodeReach(quadTree, node.cell);
+		minX.push_back(node.cell.SWCornerX - margin);
+		maxX.push_back(node.cell.SWCornerX + node.cell.size + margin);
+		minZ.push_back(node.cell.SWCornerZ - node.cell.size - margin);
+		maxZ.push_back(node.cell.SWCornerZ + margin);
+	}
+	
+	const QuadTreeCell& area = quadTree.root;
+	const float step = area.size / CULL_STEPS;
+	vector<FrustumQuad> frustums;
+	float quad[8];
+	for (int i = 0; i < CULL_STEPS; ++i)
+	{
+		for (int j = 0; j < CULL_STEPS; ++j)
+		{
+			for (int a = 0; a < CULL_ANGLES; ++a)
+			{
+				CraftFrustum(area.SWCornerX + i * step, area.SWCornerZ - j * step, a * 360.f / CULL_ANGLES, quad);
+				frustums.push_back(MakeFrustumQuad(quad[0], quad[1], quad[2], quad[3], quad[4], quad[5], quad[6], quad[7]));
+			}
+		}
+	}
+	
+	const size_t tests = frustums.size() * minX.size();
+	vector<unsigned char> overlaps(tests);
+	auto start = BenchmarkClock::now();
+	size_t at = 0;
+	for (const FrustumQuad& f : frustums)
+	{
+		for (size_t n = 0; n < minX.size(); ++n)
+		{
+			overlaps[at++] = checkQuadrilateralsIntersection(f.x[0], f.z[0], f.x[1], f.z[1], f.x[2], f.z[2], f.x[3], f.z[3],
+				minX[n], maxZ[n], minX[n], minZ[n], maxX[n], minZ[n], maxX[n], maxZ[n]) != 0;
+		}
+	}
+	const double quadrilateral = ElapsedMilliseconds(start);
+	
+	size_t disagreements = 0, inside = 0;
+	start = BenchmarkClock::now();
+	at = 0;
+	for (const FrustumQuad& f : frustums)
+	{
+		for (size_t n = 0; n < minX.size(); ++n)
+		{
+			const FrustumOverlap overlap = ClassifyBoxInFrustum(f, minX[n], minZ[n], maxX[n], maxZ[n]);
+			disagreements += (overlap != FrustumOverlap::Outside) != (overlaps[at++] != 0);
+			inside += overlap == FrustumOverlap::Inside;
+		}
+	}
+	const double separatingAxes = ElapsedMilliseconds(start);
+	
+	cout << "Node test (" << tests << " box/frustum pairs):" << endl;
+	cout << "  quadrilateral check: " << quadrilateral * 1e6 / tests << " ns per node" << endl;
+	cout << "  separating axes: " << separatingAxes * 1e6 / tests << " ns per node, "
+		<< inside << " boxes fully inside, " << disagreements << " disagreements" << endl;
+}
+
+/**
+ * System comparing one cull per viewport with the single walk that culls both
+ * The craft visits the cull lattice like in the other cull benchmarks and the fixed camera of the left viewport
+ * looks from the origin, every frame culls both views. The lists of both ways have to hold the same asteroids.
+ */
+static void MultiFrustumSystem(const QuadTree& quadTree)
+{
+	const QuadTreeCell& area = quadTree.root;
+	const float step = area.size / CULL_STEPS;
+	float quad[8];
+	CraftFrustum(0.f, 0.f, 0.f, quad); // the frustum of the fixed camera
+	FrustumQuad frustums[2] = { MakeFrustumQuad(quad[0], quad[1], quad[2], quad[3], quad[4], quad[5], quad[6], quad[7]) };
+	vector<FrustumQuad> craft;
+	for (int i = 0; i < CULL_STEPS; ++i)
+	{
+		for (int j = 0; j < CULL_STEPS; ++j)
+		{
+			for (int a = 0; a < CULL_ANGLES; ++a)
+			{
+				CraftFrustum(area.SWCornerX + i * step, area.SWCornerZ - j * step, a * 360.f / CULL_ANGLES, quad);
+				craft.push_back(MakeFrustumQuad(quad[0], quad[1], quad[2], quad[3], quad[4], quad[5], quad[6], quad[7]));
+			}
+		}
+	}
+	
+	vector<unsigned int> separate[2], single[2];
+	double separateTime = 0.0, singleTime = 0.0;
+	unsigned int mismatches = 0;
+	for (int run = 0; run < BENCHMARK_RUNS; ++run)
+	{
+		for (const FrustumQuad& view : craft)
+		{
+			frustums[1] = view;
+			auto start = BenchmarkClock::now();
+			for (int f = 0; f < 2; ++f)
+			{
+				vector<unsigned int>& list = separate[f];
+				list.clear();
+				NoQueryStats stats;
+				CullAsteroidsSystem(frustums[f], quadTree, [&list](const unsigned int at){ list.push_back(at); }, stats);
+			}
+			separateTime += ElapsedMilliseconds(start);
+			
+			start = BenchmarkClock::now();
+			CullAsteroidsSystem(frustums, 2, quadTree, single);
+			singleTime += ElapsedMilliseconds(start);
+			
+			if (run == 0)
+			{
+				for (int f = 0; f < 2; ++f)
+				{
+					sort(separate[f].begin(), separate[f].end());
+					sort(single[f].begin(), single[f].end());
+					mismatches += separate[f] != single[f];
+				}
+			}
+		}
+	}
+	
+	cout << "Two viewport culls (" << craft.size() << " frames):" << endl;
+	cout << "  one cull per viewport: " << separateTime / BENCHMARK_RUNS << " ms" << endl;
+	cout << "  single walk: " << singleTime / BENCHMARK_RUNS << " ms";
+	if (mismatches > 0)
+	{
+		cout << ", " << mismatches << " WRONG RESULTS";
+	}
+	cout << endl;
+}
+
+/**
+ * System for finding the best leaf capacity, prints build, collision query and frustum cull cost for every bucket size
+ */
+static void LeafCapacitySweepSystem(QuadTree& quadTree)
+{
+	const QuadTreeCell root = quadTree.root;
+	const unsigned int defaultCapacity = quadTree.leafCapacity;
+	
+	cout << "Leaf capacity sweep (recursive build, " << QUERY_SWEEP_POINTS << " collision queries, "
+		<< CULL_STEPS * CULL_STEPS * CULL_ANGLES << " frustum culls):" << endl;
+	for (unsigned int capacity = 1; capacity <= 64; capacity *= 2)
+	{
+		quadTree.leafCapacity = capacity;
+		const double build = BenchmarkBuildSystem(quadTree, QuadTreeBuildMode::Recursive);
+		cout << "  capacity " << capacity
+			<< ": build " << build << " ms"
+			<< ", " << quadTree.nodes.size() << " nodes"
+			<< ", " << quadTree.limitedLeaves << " limited leaves"
+			<< ", queries " << BenchmarkGatherSystem(quadTree, root) << " ms"
+			<< ", culls " << BenchmarkCullSystem(quadTree, root) << " ms" << endl;
+	}
+	
+	quadTree.leafCapacity = defaultCapacity;
+	QuadTreeInitializeSystem(root.SWCornerX, root.SWCornerZ, root.size, quadTree);
+}
+
+/**
+ * System for comparing N incremental updates against rebuilding the whole tree
+ * Every run starts from a fresh build and moves N asteroids, spread over the field, by UPDATE_STEP.
+ */
+static void IncrementalUpdateSystem(QuadTree& quadTree)
+{
+	const QuadTreeCell root = quadTree.root;
+	const unsigned int length = quadTree.length;
+	auto& asteroids = quadTree.arrayAsteroids;
+	const vector<float> savedX(asteroids.x.begin(), asteroids.x.begin() + length);
+	const vector<float> savedZ(asteroids.z.begin(), asteroids.z.begin() + length);
+	
+	const double rebuild = BenchmarkBuildSystem(quadTree, QuadTreeBuildMode::Recursive);
+	cout << "Incremental updates (rebuild " << rebuild << " ms):" << endl;
+	
+	for (unsigned int updates = 10; updates <= length; updates *= 10)
+	{
+		double elapsed = 0.0;
+		unsigned int errors = 0;
+		for (int run = 0; run < BENCHMARK_RUNS; ++run)
+		{
+			QuadTreeInitializeSystem(root.SWCornerX, root.SWCornerZ, root.size, quadTree);
+			
+			const auto start = BenchmarkClock::now();
+			for (unsigned int i = 0; i < updates; ++i)
+			{
+				const unsigned int at = static_cast<unsigned int>((i * 7919ull + run) % length); // 7919 is prime, no repeats below length
+				const float direction = (i & 1) ? UPDATE_STEP : -UPDATE_STEP;
+				asteroids.x[at] += direction;
+				asteroids.z[at] -= direction;
+				UpdateAsteroidSystem(quadTree, at);
+			}
+			elapsed += ElapsedMilliseconds(start);
+			
+			// the changed tree is no longer packed, the culls walk its subtrees bucket by bucket
+			if (run == BENCHMARK_RUNS - 1)
+			{
+				errors = ValidateSpatialIndexSystem(quadTree, asteroids, length, root);
+			}
+			copy(savedX.begin(), savedX.end(), asteroids.x.begin());
+			copy(savedZ.begin(), savedZ.end(), asteroids.z.begin());
+		}
+		elapsed /= BENCHMARK_RUNS;
+		
+		cout << "  " << updates << " updates: " << elapsed << " ms"
+			<< " (" << 1000.0 * elapsed / updates << " us each)"
+			<< ", " << quadTree.garbageNodes << " garbage nodes, " << quadTree.garbageEntries << " garbage entries"
+			<< ", break-even at " << static_cast<unsigned int>(rebuild / elapsed * updates) << " updates";
+		if (errors > 0)
+		{
+			cout << ", " << errors << " WRONG RESULTS";
+		}
+		cout << endl;
+	}
+	
+	// one asteroid moved diagonally out of every corner of the root, the margin is per axis but the gathers are discs
+	const auto stored = find_if(asteroids.rds.begin(), asteroids.rds.begin() + length, [](const float rds){ return rds > 0.f; });
+	const unsigned int moved = static_cast<unsigned int>(stored - asteroids.rds.begin());
+	unsigned int outsideErrors = 0;
+	for (int corner = 0; corner < 4 && moved < length; ++corner)
+	{
+		QuadTreeInitializeSystem(root.SWCornerX, root.SWCornerZ, root.size, quadTree);
+		const float out = root.size / 4.f;
+		asteroids.x[moved] = (corner & 2) ? root.SWCornerX + root.size + out : root.SWCornerX - out;
+		asteroids.z[moved] = (corner & 1) ? root.SWCornerZ + out : root.SWCornerZ - root.size - out;
+		UpdateAsteroidSystem(quadTree, moved);
+		outsideErrors += ValidateSpatialIndexSystem(quadTree, asteroids, length, root);
+		for (const QuadTreeBuildMode mode : { QuadTreeBuildMode::Recursive, QuadTreeBuildMode::Parallel, QuadTreeBuildMode::Morton })
+		{
+			QuadTreeInitializeSystem(root.SWCornerX, root.SWCornerZ, root.size, quadTree, mode);
+			outsideErrors += ValidateSpatialIndexSystem(quadTree, asteroids, length, root);
+		}
+		asteroids.x[moved] = savedX[moved];
+		asteroids.z[moved] = savedZ[moved];
+	}
+	cout << "  asteroid moved diagonally out of the root: updated and rebuilt by every builder";
+	if (outsideErrors > 0)
+	{
+		cout << ", " << outsideErrors << " WRONG RESULTS";
+	}
+	cout << endl;
+	
+	QuadTreeInitializeSystem(root.SWCornerX, root.SWCornerZ, root.size, quadTree);
+}
+
+/**
+ * System for timing queries and updates on a loose tree with the given looseness
+ */
+static void LooseTreeSystem(QuadTree& quadTree, const float looseness)
+{
+	const QuadTreeCell root = quadTree.root;
+	const float defaultLooseness = quadTree.looseness;
+	
+	quadTree.looseness = looseness;
+	cout << "Loose tree (k = " << looseness << "):" << endl;
+	cout << "  build " << BenchmarkBuildSystem(quadTree, QuadTreeBuildMode::Recursive) << " ms"
+		<< ", " << quadTree.nodes.size() << " nodes"
+		<< ", queries " << BenchmarkGatherSystem(quadTree, root) << " ms" << endl;
+	IncrementalUpdateSystem(quadTree);
+	
+	quadTree.looseness = defaultLooseness;
+	QuadTreeInitializeSystem(root.SWCornerX, root.SWCornerZ, root.size, quadTree);
+}
+
+/**
+ * System for moving every asteroid into one of BENCHMARK_CLUSTERS clusters inside the root square
+ */
+static void ClusterAsteroidsSystem(Asteroids& asteroids, const unsigned int length, const QuadTreeCell& root)
+{
+	float centreX[BENCHMARK_CLUSTERS], centreZ[BENCHMARK_CLUSTERS];
+	const float inner = root.size - 2.f * BENCHMARK_CLUSTER_SPREAD;
+	for (int c = 0; c < BENCHMARK_CLUSTERS; ++c)
+	{
+		centreX[c] = root.SWCornerX + BENCHMARK_CLUSTER_SPREAD + inner * (rand() % 1000) / 1000.f;
+		centreZ[c] = root.SWCornerZ - BENCHMARK_CLUSTER_SPREAD - inner * (rand() % 1000) / 1000.f;
+	}
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		const int c = i % BENCHMARK_CLUSTERS;
+		asteroids.x[i] = centreX[c] + BENCHMARK_CLUSTER_SPREAD * ((rand() % 2001) / 1000.f - 1.f);
+		asteroids.z[i] = centreZ[c] + BENCHMARK_CLUSTER_SPREAD * ((rand() % 2001) / 1000.f - 1.f);
+	}
+}
+
+/**
+ * System for giving the asteroids of the lattice field mixed sizes, a few large ones among many small ones
+ */
+static void MixAsteroidSizesSystem(Asteroids& asteroids, const unsigned int length)
+{
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		if (asteroids.rds[i] > 0.f)
+		{
+			asteroids.rds[i] = i % BENCHMARK_LARGE_EVERY == 0 ? BENCHMARK_LARGE_RADIUS : 1.f + 4.f * (rand() % 1000) / 1000.f;
+		}
+	}
+}
+
+/**
+ * System for comparing all the spatial index backends on the lattice field, a clustered one and a mixed size one
+ */
+static void SpatialIndexComparisonSystem(QuadTree& quadTree)
+{
+	const QuadTreeCell root = quadTree.root;
+	const unsigned int length = quadTree.length;
+	auto& asteroids = quadTree.arrayAsteroids;
+	const vector<float> savedX(asteroids.x.begin(), asteroids.x.begin() + length);
+	const vector<float> savedZ(asteroids.z.begin(), asteroids.z.begin() + length);
+	const vector<float> savedRds(asteroids.rds.begin(), asteroids.rds.begin() + length);
+	
+	UniformGrid grid;
+	KdTree kdTree;
+	Bvh bvh;
+	Octree octree;
+	const char* fields[] = { "Lattice field (", "Clustered field (", "Mixed size field (" };
+	for (int field = 0; field < 3; ++field)
+	{
+		if (field == 1)
+		{
+			ClusterAsteroidsSystem(asteroids, length, root);
+		}
+		else if (field == 2)
+		{
+			copy(savedX.begin(), savedX.end(), asteroids.x.begin());
+			copy(savedZ.begin(), savedZ.end(), asteroids.z.begin());
+			MixAsteroidSizesSystem(asteroids, length);
+		}
+		
+		cout << fields[field] << QUERY_SWEEP_POINTS << " collision queries, "
+			<< CULL_STEPS * CULL_STEPS * CULL_ANGLES << " frustum culls):" << endl;
+		BenchmarkSpatialIndexSystem(quadTree, asteroids, length, root);
+		BenchmarkSpatialIndexSystem(grid, asteroids, length, root);
+		BenchmarkSpatialIndexSystem(kdTree, asteroids, length, root);
+		BenchmarkSpatialIndexSystem(bvh, asteroids, length, root);
+		BenchmarkSpatialIndexSystem(octree, asteroids, length, root);
+	}
+	
+	copy(savedX.begin(), savedX.end(), asteroids.x.begin());
+	copy(savedZ.begin(), savedZ.end(), asteroids.z.begin());
+	copy(savedRds.begin(), savedRds.end(), asteroids.rds.begin());
+	QuadTreeInitializeSystem(root.SWCornerX, root.SWCornerZ, root.size, quadTree);
+}
+
+/**
+ * System for comparing culls with the 3D octree against the x/z QuadTree on a field that fills a volume
+ * The QuadTree finds every asteroid in the vertical prism under the frustum, the octree only those in view,
+ * both counts are printed with the times. The octree results are checked against brute force.
+ */
+static void VolumeFieldSystem(QuadTree& quadTree)
+{
+	const QuadTreeCell root = quadTree.root;
+	const unsigned int length = quadTree.length;
+	auto& asteroids = quadTree.arrayAsteroids;
+	const vector<float> savedY(asteroids.y.begin(), asteroids.y.begin() + length);
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		asteroids.y[i] = FIELD_VOLUME_HEIGHT * ((rand() % 1001) / 1000.f - 0.5f);
+	}
+	QuadTreeInitializeSystem(root.SWCornerX, root.SWCornerZ, root.size, quadTree);
+	
+	Octree octree;
+	auto start = BenchmarkClock::now();
+	for (int run = 0; run < BENCHMARK_RUNS; ++run)
+	{
+		OctreeInitializeSystem(root.SWCornerX, root.SWCornerZ, root.size, asteroids, length, octree);
+	}
+	const double build = ElapsedMilliseconds(start) / BENCHMARK_RUNS;
+	
+	// one sweep of CULL_STEPS^2 * CULL_ANGLES culls with both, found counts the asteroids of each
+	const float step = root.size / CULL_STEPS;
+	size_t found[2] = {};
+	double elapsed[2] = {};
+	float quad[8];
+	for (int run = 0; run < BENCHMARK_RUNS; ++run)
+	{
+		for (int tree = 0; tree < 2; ++tree)
+		{
+			size_t& count = found[tree];
+			count = 0;
+			start = BenchmarkClock::now();
+			for (int i = 0; i < CULL_STEPS; ++i)
+			{
+				for (int j = 0; j < CULL_STEPS; ++j)
+				{
+					for (int a = 0; a < CULL_ANGLES; ++a)
+					{
+						const float x = root.SWCornerX + i * step, z = root.SWCornerZ - j * step, angle = a * 360.f / CULL_ANGLES;
+						if (tree == 0)
+						{
+							CraftFrustum(x, z, angle, quad);
+							CullAsteroidsSystem(quad[0], quad[1], quad[2], quad[3], quad[4], quad[5], quad[6], quad[7], quadTree,
+								[&count](const unsigned int){ ++count; });
+						}
+						else
+						{
+							CullAsteroidsSystem(CraftFrustumPlanes(x, z, angle), octree, [&count](const unsigned int){ ++count; });
+						}
+					}
+				}
+			}
+			elapsed[tree] += ElapsedMilliseconds(start);
+		}
+	}
+	
+	// brute force check of the 3D queries
+	unsigned int errors = 0;
+	vector<unsigned char> seen(length);
+	vector<Location> al;
+	for (int i = 0; i < VALIDATION_STEPS; ++i)
+	{
+		for (int j = 0; j < VALIDATION_STEPS; ++j)
+		{
+			const float x = root.SWCornerX + (i + 0.5f) * root.size / VALIDATION_STEPS;
+			const float z = root.SWCornerZ - (j + 0.5f) * root.size / VALIDATION_STEPS;
+			const float y = FIELD_VOLUME_HEIGHT * ((i + j) % 5 - 2) / 5.f;
+			const FrustumPlanes planes = CraftFrustumPlanes(x, z, (i * VALIDATION_STEPS + j) * 37.f);
+			
+			fill(seen.begin(), seen.end(), 0);
+			CullAsteroidsSystem(planes, octree, [&](const unsigned int at){ errors += seen[at]++ > 0; });
+			al.clear();
+			GatherAsteroidSystem(x, y, z, 7.072f, octree, al);
+			for (const Location& loc : al)
+			{
+				seen[loc.index] |= 2;
+			}
+			for (unsigned int a = 0; a < length; ++a)
+			{
+				float distance = FLT_MAX;
+				for (int p = 0; p < 6; ++p)
+				{
+					distance = glm::min(distance, planes.nx[p] * asteroids.x[a] + planes.ny[p] * asteroids.y[a] + planes.nz[p] * asteroids.z[a] + planes.d[p]);
+				}
+				const float dx = asteroids.x[a] - x, dy = asteroids.y[a] - y, dz = asteroids.z[a] - z, reach = 7.072f + asteroids.rds[a];
+				errors += asteroids.rds[a] > 0.f && (seen[a] & 1) == 0 && distance >= 0.f;
+				errors += asteroids.rds[a] > 0.f && (seen[a] & 2) == 0 && dx * dx + dy * dy + dz * dz <= reach * reach;
+			}
+		}
+	}
+	
+	const int culls = CULL_STEPS * CULL_STEPS * CULL_ANGLES;
+	cout << "Volume field (" << FIELD_VOLUME_HEIGHT << " high, " << culls << " frustum culls):" << endl;
+	cout << "  quadtree: culls " << elapsed[0] / BENCHMARK_RUNS << " ms, " << found[0] / culls << " asteroids per cull" << endl;
+	cout << "  octree: build " << build << " ms, " << octree.nodes.size() << " nodes"
+		<< ", culls " << elapsed[1] / BENCHMARK_RUNS << " ms, " << found[1] / culls << " asteroids per cull";
+	if (errors > 0)
+	{
+		cout << ", " << errors << " WRONG RESULTS";
+	}
+	cout << endl;
+	
+	copy(savedY.begin(), savedY.end(), asteroids.y.begin());
+	QuadTreeInitializeSystem(root.SWCornerX, root.SWCornerZ, root.size, quadTree);
+}
+
+/**
+ * System that runs all the benchmarks and prints the results
+ * @param quadTree an already initialized QuadTree, rebuilt with the default mode when done
+ */
+static void RunBenchmarksSystem(QuadTree& quadTree)
+{
+	cout << "Benchmarking " << quadTree.length << " asteroid slots, "
+		<< BENCHMARK_RUNS << " runs each" << endl;
+	
+	cout << "Build (recursive): " << BenchmarkBuildSystem(quadTree, QuadTreeBuildMode::Recursive) << " ms" << endl;
+	cout << "Build (parallel):  " << BenchmarkBuildSystem(quadTree, QuadTreeBuildMode::Parallel) << " ms" << endl;
+	cout << "Build (morton):    " << BenchmarkBuildSystem(quadTree, QuadTreeBuildMode::Morton) << " ms" << endl;
+	ParallelScalingSystem(quadTree);
+	
+	StatisticsSystem(quadTree);
+	NodeLayoutSystem(quadTree);
+	NodeTestSystem(quadTree);
+	MultiFrustumSystem(quadTree);
+	LeafCapacitySweepSystem(quadTree);
+	IncrementalUpdateSystem(quadTree);
+	LooseTreeSystem(quadTree, 2.f);
+	SpatialIndexComparisonSystem(quadTree);
+	VolumeFieldSystem(quadTree);
+}
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include "MappedFile.h"
+#include "QuadTree.h"
+
+// Binary snapshot of a built QuadTree and its Asteroids, so that later launches skip generating and building.
+// The file is a header followed by raw blocks at 64 byte aligned offsets from the start of the file, no pointers.
+// Loading maps the file and copies the blocks straight into the QuadTree, nothing is sorted or partitioned.
+// A snapshot only loads if it was written by the same format, builder and field generator for the same field and tree settings.
+
+using namespace std;
+
+constexpr auto QUADTREE_SNAPSHOT_FILE = "asteroidField.qts";
+constexpr uint32_t QUADTREE_SNAPSHOT_VERSION = 8; // bump when the layout of the file changes
+constexpr uint32_t QUADTREE_SNAPSHOT_BYTE_ORDER = 0x01020304;
+constexpr uint64_t QUADTREE_SNAPSHOT_ALIGNMENT = 64;
+
+struct QuadTreeSnapshotHeader
+{
+	char magic[4]; // "QTSN"
+	uint32_t byteOrder; // QUADTREE_SNAPSHOT_BYTE_ORDER as written by the machine that saved the file
+	uint32_t formatVersion;
+	uint32_t builderVersion;
+	uint32_t generatorVersion; // ASTEROID_FIELD_GENERATOR_VERSION
+	
+	// what the field was generated from
+	uint32_t rows, columns, fillProbability, seed;
+	
+	// tree settings and state
+	uint32_t leafCapacity, maxDepth;
+	float minCellSize, looseness;
+	float boundsMargin;
+	float rootX, rootZ, rootSize; // QuadTree::root
+	uint32_t limitedLeaves, garbageNodes, garbageEntries;
+	uint32_t packedEntries; // QuadTree::packedEntries, 0 or 1
+	uint32_t length;
+	uint32_t nodeSize; // sizeof(QuadTreeNode), the nodes are stored as they are in memory
+	uint32_t bucketSize; // sizeof(QuadTreeBucket), one per node
+	uint32_t nodeCount, entryCount;
+	
+	// file offsets of the blocks
+	uint64_t asteroidX, asteroidY, asteroidZ, asteroidI, asteroidRds, asteroidR, asteroidG, asteroidB; // QuadTree::arrayAsteroids
+	uint64_t nodes;
+	uint64_t buckets;
+	uint64_t entryX, entryY, entryZ, entryRds, entryIndex;
+	uint64_t entrySlots;
+	uint64_t fileSize;
+};
+
+// Header describing quadTree as a snapshot of the current build, the offsets are not filled in
+static QuadTreeSnapshotHeader MakeSnapshotHeader(const QuadTree& quadTree, const AsteroidFieldSettings& field, const unsigned int seed)
+{
+	QuadTreeSnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "QTSN", 4);
+	header.byteOrder = QUADTREE_SNAPSHOT_BYTE_ORDER;
+	header.formatVersion = QUADTREE_SNAPSHOT_VERSION;
+	header.builderVersion = QUADTREE_BUILDER_VERSION;
+	header.generatorVersion = ASTEROID_FIELD_GENERATOR_VERSION;
+	header.rows = field.rows;
+	header.columns = field.columns;
+	header.fillProbability = field.fillProbability;
+	header.seed = seed;
+	header.leafCapacity = quadTree.leafCapacity;
+	header.maxDepth = quadTree.maxDepth;
+	header.minCellSize = quadTree.minCellSize;
+	header.looseness = quadTree.looseness;
+	header.length = quadTree.length;
+	header.nodeSize = sizeof(QuadTreeNode);
+	header.bucketSize = sizeof(QuadTreeBucket);
+	return header;
+}
+
+// Offset of the next block after size bytes at offset
+static uint64_t NextSnapshotBlock(const uint64_t offset, const uint64_t size)
+{
+	return (offset + size + QUADTREE_SNAPSHOT_ALIGNMENT - 1) / QUADTREE_SNAPSHOT_ALIGNMENT * QUADTREE_SNAPSHOT_ALIGNMENT;
+}
+
+/**
+ * System for writing quadTree and its asteroids to a snapshot file
+ * @param field the settings the asteroid field was generated with
+ * @param seed the random seed the asteroid field was generated with
+ * @return false if the file could not be written
+ */
+static bool SaveSnapshotSystem(const char* path, const QuadTree& quadTree, const AsteroidFieldSettings& field, const unsigned int seed)
+{
+	QuadTreeSnapshotHeader header = MakeSnapshotHeader(quadTree, field, seed);
+	header.boundsMargin = quadTree.boundsMargin;
+	header.rootX = quadTree.root.SWCornerX;
+	header.rootZ = quadTree.root.SWCornerZ;
+	header.rootSize = quadTree.root.size;
+	header.limitedLeaves = quadTree.limitedLeaves;
+	header.garbageNodes = quadTree.garbageNodes;
+	header.garbageEntries = quadTree.garbageEntries;
+	header.packedEntries = quadTree.packedEntries ? 1 : 0;
+	header.nodeCount = static_cast<uint32_t>(quadTree.nodes.size());
+	header.entryCount = static_cast<uint32_t>(quadTree.entries.size());
+	
+	const uint64_t floats = header.entryCount * sizeof(float);
+	const uint64_t indices = header.entryCount * sizeof(unsigned int);
+	const uint64_t asteroidFloats = header.length * sizeof(float);
+	header.asteroidX = NextSnapshotBlock(0, sizeof(QuadTreeSnapshotHeader));
+	header.asteroidY = NextSnapshotBlock(header.asteroidX, asteroidFloats);
+	header.asteroidZ = NextSnapshotBlock(header.asteroidY, asteroidFloats);
+	header.asteroidI = NextSnapshotBlock(header.asteroidZ, asteroidFloats);
+	header.asteroidRds = NextSnapshotBlock(header.asteroidI, asteroidFloats);
+	header.asteroidR = NextSnapshotBlock(header.asteroidRds, asteroidFloats);
+	header.asteroidG = NextSnapshotBlock(header.asteroidR, header.length);
+	header.asteroidB = NextSnapshotBlock(header.asteroidG, header.length);
+	header.nodes = NextSnapshotBlock(header.asteroidB, header.length);
+	header.buckets = NextSnapshotBlock(header.nodes, header.nodeCount * sizeof(QuadTreeNode));
+	header.entryX = NextSnapshotBlock(header.buckets, header.nodeCount * sizeof(QuadTreeBucket));
+	header.entryY = NextSnapshotBlock(header.entryX, floats);
+	header.entryZ = NextSnapshotBlock(header.entryY, floats);
+	header.entryRds = NextSnapshotBlock(header.entryZ, floats);
+	header.entryIndex = NextSnapshotBlock(header.entryRds, floats);
+	header.entrySlots = NextSnapshotBlock(header.entryIndex, indices);
+	header.fileSize = header.entrySlots + quadTree.entrySlots.size() * sizeof(unsigned int);
+	
+	ofstream file(path, ios::binary | ios::trunc);
+	const auto writeBlock = [&file](const uint64_t offset, const void* source, const uint64_t size)
+	{
+		file.seekp(static_cast<streamoff>(offset));
+		file.write(static_cast<const char*>(source), static_cast<streamsize>(size));
+	};
+	
+	const auto& entries = quadTree.entries;
+	writeBlock(0, &header, sizeof(header));
+	const auto& asteroids = quadTree.arrayAsteroids;
+	writeBlock(header.asteroidX, asteroids.x.data(), asteroidFloats);
+	writeBlock(header.asteroidY, asteroids.y.data(), asteroidFloats);
+	writeBlock(header.asteroidZ, asteroids.z.data(), asteroidFloats);
+	writeBlock(header.asteroidI, asteroids.i.data(), asteroidFloats);
+	writeBlock(header.asteroidRds, asteroids.rds.data(), asteroidFloats);
+	writeBlock(header.asteroidR, asteroids.r.data(), header.length);
+	writeBlock(header.asteroidG, asteroids.g.data(), header.length);
+	writeBlock(header.asteroidB, asteroids.b.data(), header.length);
+	writeBlock(header.nodes, quadTree.nodes.data(), header.nodeCount * sizeof(QuadTreeNode));
+	writeBlock(header.buckets, quadTree.buckets.data(), header.nodeCount * sizeof(QuadTreeBucket));
+	writeBlock(header.entryX, entries.x.data(), floats);
+	writeBlock(header.entryY, entries.y.data(), floats);
+	writeBlock(header.entryZ, entries.z.data(), floats);
+	writeBlock(header.entryRds, entries.rds.data(), floats);
+	writeBlock(header.entryIndex, entries.index.data(), indices);
+	writeBlock(header.entrySlots, quadTree.entrySlots.data(), quadTree.entrySlots.size() * sizeof(unsigned int));
+	return file.good();
+}
+
+/**
+ * System for replacing quadTree and its asteroids with a snapshot file
+ * The tree settings of quadTree (leafCapacity, maxDepth, minCellSize, looseness) and its length have to match the snapshot.
+ * @param field the settings the asteroid field would be generated with
+ * @param seed the random seed the asteroid field would be generated with
+ * @return false if there is no valid snapshot for this field, quadTree is left untouched then
+ */
+static bool LoadSnapshotSystem(const char* path, QuadTree& quadTree, const AsteroidFieldSettings& field, const unsigned int seed)
+{
+	MappedFile file;
+	if (!file.Open(path) || file.size() < sizeof(QuadTreeSnapshotHeader))
+	{
+		return false;
+	}
+	
+	QuadTreeSnapshotHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	
+	// everything up to the tree state has to be what this build would write
+	const QuadTreeSnapshotHeader expected = MakeSnapshotHeader(quadTree, field, seed);
+	if (memcmp(&header, &expected, offsetof(QuadTreeSnapshotHeader, boundsMargin)) != 0 ||
+		header.length != expected.length || header.nodeSize != expected.nodeSize ||
+		header.bucketSize != expected.bucketSize ||
+		header.fileSize != file.size() || header.nodeCount == 0)
+	{
+		return false;
+	}
+	
+	// the blocks have to lie inside the file, checked in the order they were written
+	const uint64_t floats = header.entryCount * sizeof(float);
+	const uint64_t indices = header.entryCount * sizeof(unsigned int);
+	const uint64_t asteroidFloats = header.length * sizeof(float);
+	const uint64_t blocks[][2] = {
+		{ header.asteroidX, asteroidFloats }, { header.asteroidY, asteroidFloats }, { header.asteroidZ, asteroidFloats },
+		{ header.asteroidI, asteroidFloats }, { header.asteroidRds, asteroidFloats },
+		{ header.asteroidR, header.length }, { header.asteroidG, header.length }, { header.asteroidB, header.length },
+		{ header.nodes, header.nodeCount * sizeof(QuadTreeNode) },
+		{ header.buckets, header.nodeCount * sizeof(QuadTreeBucket) },
+		{ header.entryX, floats }, { header.entryY, floats }, { header.entryZ, floats }, { header.entryRds, floats },
+		{ header.entryIndex, indices },
+		{ header.entrySlots, header.length * sizeof(unsigned int) }
+	};
+	uint64_t end = sizeof(QuadTreeSnapshotHeader);
+	for (const auto& block : blocks)
+	{
+		if (block[0] < end || block[0] % QUADTREE_SNAPSHOT_ALIGNMENT != 0 || block[0] > file.size() || block[1] > file.size() - block[0])
+		{
+			return false;
+		}
+		end = block[0] + block[1];
+	}
+	
+	const unsigned char* data = file.data();
+	QuadTreeResetSystem(quadTree);
+	auto& asteroids = quadTree.arrayAsteroids;
+	asteroids.Resize(header.length);
+	memcpy(asteroids.x.data(), data + header.asteroidX, asteroidFloats);
+	memcpy(asteroids.y.data(), data + header.asteroidY, asteroidFloats);
+	memcpy(asteroids.z.data(), data + header.asteroidZ, asteroidFloats);
+	memcpy(asteroids.i.data(), data + header.asteroidI, asteroidFloats);
+	memcpy(asteroids.rds.data(), data + header.asteroidRds, asteroidFloats);
+	memcpy(asteroids.r.data(), data + header.asteroidR, header.length);
+	memcpy(asteroids.g.data(), data + header.asteroidG, header.length);
+	memcpy(asteroids.b.data(), data + header.asteroidB, header.length);
+	quadTree.nodes.Append(reinterpret_cast<const QuadTreeNode*>(data + header.nodes), header.nodeCount);
+	quadTree.buckets.Append(reinterpret_cast<const QuadTreeBucket*>(data + header.buckets), header.nodeCount);
+	
+	const auto loadColumn = [&header, data](vector<float>& column, const uint64_t offset)
+	{
+		const float* source = reinterpret_cast<const float*>(data + offset);
+		column.assign(source, source + header.entryCount);
+		column.resize(header.entryCount + SIMD_WIDTH - 1, 0.f);
+	};
+	auto& entries = quadTree.entries;
+	loadColumn(entries.x, header.entryX);
+	loadColumn(entries.y, header.entryY);
+	loadColumn(entries.z, header.entryZ);
+	loadColumn(entries.rds, header.entryRds);
+	const unsigned int* index = reinterpret_cast<const unsigned int*>(data + header.entryIndex);
+	entries.index.assign(index, index + header.entryCount);
+	const unsigned int* slots = reinterpret_cast<const unsigned int*>(data + header.entrySlots);
+	quadTree.entrySlots.assign(slots, slots + header.length);
+	
+	quadTree.boundsMargin = header.boundsMargin;
+	quadTree.root = QuadTreeCell(header.rootX, header.rootZ, header.rootSize);
+	quadTree.limitedLeaves = header.limitedLeaves;
+	quadTree.garbageNodes = header.garbageNodes;
+	quadTree.garbageEntries = header.garbageEntries;
+	quadTree.packedEntries = header.packedEntries != 0;
+	return true;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include "QuadTree.h"
+#include "QueryStats.h"
+
+// Shape and memory statistics of a built QuadTree, printed by the benchmarks and by the statistics key of the app.
+// Gathering them walks the whole tree, nothing is counted while building or querying.
+
+struct QuadTreeStats
+{
+	QuadTreeStats(){nodeCount = leafCount = entryCount = duplicateEntries = 0; bytes = 0; buildMilliseconds = 0.f;}
+
+	unsigned int nodeCount; // nodes reachable from the root, without the garbage of incremental changes
+	unsigned int leafCount;
+	std::vector<unsigned int> depthHistogram; // number of nodes at every depth, the root is depth 0
+	unsigned int entryCount; // items stored in the buckets of the reachable nodes
+	unsigned int duplicateEntries; // items stored in more than one bucket, 0 unless something went wrong
+	size_t bytes; // memory reserved by the nodes, buckets, entries and entry slots
+	float buildMilliseconds; // duration of the last build
+};
+
+/**
+ * System for collecting the statistics of a QuadTree
+ * Walks the nodes from the root, so the nodes left unreachable by incremental changes are not counted.
+ */
+static QuadTreeStats QuadTreeStatsSystem(const QuadTree& quadTree)
+{
+	QuadTreeStats stats;
+	stats.buildMilliseconds = quadTree.buildMilliseconds;
+
+	const auto& entries = quadTree.entries;
+	stats.bytes = quadTree.nodes.CapacityBytes() + quadTree.buckets.CapacityBytes() +
+		(entries.x.capacity() + entries.y.capacity() + entries.z.capacity() + entries.rds.capacity()) * sizeof(float) +
+		(entries.index.capacity() + quadTree.entrySlots.capacity()) * sizeof(unsigned int);
+	if (quadTree.nodes.empty())
+	{
+		return stats;
+	}
+
+	vector<unsigned char> seen(quadTree.length);
+	vector<pair<int, unsigned int>> stack(1, { 0, 0u }); // node and its depth
+	while (!stack.empty())
+	{
+		const int at = stack.back().first;
+		const unsigned int depth = stack.back().second;
+		stack.pop_back();
+
+		const QuadTreeNode& node = quadTree.nodes[at];
+		++stats.nodeCount;
+		if (depth >= stats.depthHistogram.size())
+		{
+			stats.depthHistogram.resize(depth + 1, 0);
+		}
+		++stats.depthHistogram[depth];
+
+		const QuadTreeBucket& bucket = quadTree.buckets[at];
+		for (unsigned int i = 0; i < bucket.asteroidCount; ++i)
+		{
+			stats.duplicateEntries += seen[entries.index[bucket.firstAsteroid + i]]++ > 0;
+		}
+		stats.entryCount += bucket.asteroidCount;
+
+		if (node.firstChild < 0)
+		{
+			++stats.leafCount;
+			continue;
+		}
+		int child = node.firstChild;
+		for (unsigned int mask = node.childMask; mask != 0; mask &= mask - 1)
+		{
+			stack.push_back({ child++, depth + 1 });
+		}
+	}
+	return stats;
+}
+
+// Prints the statistics of a QuadTree, one line for the shape and one for the depth histogram
+static void PrintQuadTreeStatsSystem(const QuadTreeStats& stats)
+{
+	cout << "  " << stats.nodeCount << " nodes, " << stats.leafCount << " leaves, "
+		<< stats.entryCount << " entries (" << stats.duplicateEntries << " duplicates), "
+		<< stats.bytes / 1024 << " KB, built in " << stats.buildMilliseconds << " ms" << endl;
+	cout << "  nodes per depth:";
+	for (const unsigned int count : stats.depthHistogram)
+	{
+		cout << " " << count;
+	}
+	cout << endl;
+}
+
+// Prints the counters of queries, averaged over queryCount queries
+static void PrintQueryStatsSystem(const char* name, const QueryStats& stats, const unsigned int queryCount)
+{
+	const float queries = static_cast<float>(glm::max(queryCount, 1u));
+	cout << "  " << name << ": " << stats.visited / queries << " nodes visited, "
+		<< stats.tested / queries << " items tested, " << stats.accepted / queries << " accepted per query" << endl;
+}
@@ -0,0 +1,511 @@
+#pragma once
+
+#include "QuadTree.h"
+
+// Incremental changes to a built QuadTree, for asteroids destroyed, spawned or moved at runtime.
+// The asteroid data is always read from QuadTree::arrayAsteroids, so a moved asteroid is written there
+// before UpdateAsteroidSystem is called. Every change walks a single root to leaf path and only splits or
+// merges the nodes on it. Buckets that outgrow their slots and child groups that gain a child are moved
+// to the back of their arrays, the old space stays unused until the next QuadTreeInitializeSystem.
+
+using namespace std;
+
+// Smallest number of slots given to a bucket that has to grow
+constexpr auto QUADTREE_MIN_BUCKET_CAPACITY = 4u;
+// A leaf that could not be split is tried again once its item count has grown by this factor
+constexpr auto QUADTREE_SPLIT_RETRY_GROWTH = 2u;
+
+/**
+ * System for reserving n slots at the back of the entries, keeping the SIMD padding behind them
+ * @return the first reserved slot
+ */
+static unsigned int AllocateEntrySlotsSystem(QuadTreeEntries& entries, const unsigned int n)
+{
+	const size_t first = entries.size();
+	const size_t padded = first + n + SIMD_WIDTH - 1;
+	entries.x.resize(padded, 0.f);
+	entries.y.resize(padded, 0.f);
+	entries.z.resize(padded, 0.f);
+	entries.rds.resize(padded, 0.f);
+	entries.index.resize(first + n);
+	return static_cast<unsigned int>(first);
+}
+
+// Writes loc into an entry slot and remembers where its asteroid is stored
+static void WriteEntry(QuadTree& quadTree, const unsigned int slot, const Location& loc)
+{
+	auto& entries = quadTree.entries;
+	entries.x[slot] = loc.x;
+	entries.y[slot] = loc.y;
+	entries.z[slot] = loc.z;
+	entries.rds[slot] = loc.rds;
+	entries.index[slot] = loc.index;
+	quadTree.entrySlots[loc.index] = slot;
+}
+
+/**
+ * System for giving the bucket of a node room for at least one more item
+ * A bucket that already ends at the back of the entries grows in place, any other one is moved there.
+ */
+static void GrowBucketSystem(QuadTree& quadTree, const int at)
+{
+	QuadTreeBucket& bucket = quadTree.buckets[at];
+	const unsigned int capacity = glm::max(QUADTREE_MIN_BUCKET_CAPACITY, 2 * bucket.asteroidCapacity);
+	quadTree.packedEntries = false;
+	
+	if (bucket.firstAsteroid + bucket.asteroidCapacity == quadTree.entries.size())
+	{
+		AllocateEntrySlotsSystem(quadTree.entries, capacity - bucket.asteroidCapacity);
+	}
+	else
+	{
+		const unsigned int first = AllocateEntrySlotsSystem(quadTree.entries, capacity);
+		for (unsigned int i = 0; i < bucket.asteroidCount; ++i)
+		{
+			WriteEntry(quadTree, first + i, quadTree.entries.at(bucket.firstAsteroid + i));
+		}
+		quadTree.garbageEntries += bucket.asteroidCapacity;
+		bucket.firstAsteroid = first;
+		InlineBucket(quadTree.nodes[at], bucket);
+	}
+	bucket.asteroidCapacity = capacity;
+}
+
+// Adds loc at the end of the bucket of a node
+static void AddToBucketSystem(QuadTree& quadTree, const int at, const Location& loc)
+{
+	if (quadTree.buckets[at].asteroidCount == quadTree.buckets[at].asteroidCapacity)
+	{
+		GrowBucketSystem(quadTree, at);
+	}
+	QuadTreeBucket& bucket = quadTree.buckets[at];
+	WriteEntry(quadTree, bucket.firstAsteroid + bucket.asteroidCount, loc);
+	++bucket.asteroidCount;
+	InlineBucket(quadTree.nodes[at], bucket);
+}
+
+// Takes the item in slot out of the bucket of a node, the last item of the bucket fills the hole
+static void RemoveFromBucketSystem(QuadTree& quadTree, const int at, const unsigned int slot)
+{
+	QuadTreeBucket& bucket = quadTree.buckets[at];
+	const unsigned int last = bucket.firstAsteroid + bucket.asteroidCount - 1;
+	
+	quadTree.entrySlots[quadTree.entries.index[slot]] = QUADTREE_NO_ENTRY;
+	if (slot != last)
+	{
+		WriteEntry(quadTree, slot, quadTree.entries.at(last));
+	}
+	--bucket.asteroidCount;
+	InlineBucket(quadTree.nodes[at], bucket);
+	quadTree.packedEntries = false;
+}
+
+/**
+ * System for splitting an overfull leaf with the rules of the builders
+ * The discs straddling the children stay in the bucket of the node, every occupied child gets a new bucket.
+ * Children still over capacity are split in turn. A leaf whose discs all straddle its children is not
+ * copied out again until it has grown by QUADTREE_SPLIT_RETRY_GROWTH, so filling it stays linear.
+ * @param cell square of the node at
+ */
+static void SplitLeafSystem(QuadTree& quadTree, const int at, const QuadTreeCell& cell)
+{
+	const QuadTreeBucket bucket = quadTree.buckets[at];
+	if (bucket.asteroidCount <= quadTree.leafCapacity || bucket.asteroidCount < bucket.splitRetryCount)
+	{
+		return;
+	}
+	const QuadTreeSplitPolicy policy = MakeSplitPolicy(quadTree);
+	if (cell.size / 2.f < policy.minChildSize)
+	{
+		return; // at the subdivision limits the leaf never splits
+	}
+	
+	// the children are written out before they are split in turn, so they can reuse the buffer
+	vector<Location>& nodeAsteroids = quadTree.buildAsteroids;
+	nodeAsteroids.resize(bucket.asteroidCount);
+	for (unsigned int i = 0; i < bucket.asteroidCount; ++i)
+	{
+		nodeAsteroids[i] = quadTree.entries.at(bucket.firstAsteroid + i);
+	}
+	
+	QuadTreeBucket split = bucket;
+	split.firstAsteroid = 0;
+	QuadTreeBucket childBuckets[4];
+	unsigned int limitHits = 0; // limitedLeaves only describes the last build
+	if (!SplitNodeSystem(cell, split, nodeAsteroids, policy, childBuckets, limitHits))
+	{
+		quadTree.buckets[at].splitRetryCount = QUADTREE_SPLIT_RETRY_GROWTH * bucket.asteroidCount;
+		return;
+	}
+	
+	// the straddling discs were partitioned to the front, the bucket keeps its slots
+	for (unsigned int i = 0; i < split.asteroidCount; ++i)
+	{
+		WriteEntry(quadTree, bucket.firstAsteroid + i, nodeAsteroids[i]);
+	}
+	
+	const int firstChild = static_cast<int>(quadTree.nodes.size());
+	unsigned char childMask = 0;
+	quadTree.packedEntries = false; // the children get new slots at the back of the entries
+	for (int c = 0; c < 4; ++c)
+	{
+		QuadTreeBucket& childBucket = childBuckets[c];
+		if (childBucket.asteroidCount > 0)
+		{
+			const unsigned int first = childBucket.firstAsteroid;
+			childBucket.asteroidCapacity = glm::max(childBucket.asteroidCount, quadTree.leafCapacity);
+			childBucket.firstAsteroid = AllocateEntrySlotsSystem(quadTree.entries, childBucket.asteroidCapacity);
+			for (unsigned int i = 0; i < childBucket.asteroidCount; ++i)
+			{
+				WriteEntry(quadTree, childBucket.firstAsteroid + i, nodeAsteroids[first + i]);
+			}
+			QuadTreeNode child;
+			InlineBucket(child, childBucket);
+			quadTree.nodes.push_back(child); // may move the nodes
+			quadTree.buckets.push_back(childBucket);
+			childMask |= 1 << c;
+		}
+	}
+	quadTree.buckets[at].asteroidCount = split.asteroidCount;
+	InlineBucket(quadTree.nodes[at], quadTree.buckets[at]);
+	quadTree.nodes[at].firstChild = firstChild;
+	quadTree.nodes[at].childMask = childMask;
+	
+	int child = firstChild;
+	for (int quadrant = 0; quadrant < 4; ++quadrant)
+	{
+		if (childMask & (1 << quadrant))
+		{
+			SplitLeafSystem(quadTree, child++, ChildCell(cell, quadrant));
+		}
+	}
+}
+
+/**
+ * System for creating the empty leaf child of a node in an unoccupied quadrant
+ * The children have to stay next to each other in Morton order, so the group is either widened in place
+ * when it is the last one in the array or copied to the back with room for the new child.
+ * The buckets of the group move with it.
+ * @return index of the new child
+ */
+static int AddChildSystem(QuadTree& quadTree, const int at, const int quadrant)
+{
+	auto& nodes = quadTree.nodes;
+	auto& buckets = quadTree.buckets;
+	const QuadTreeNode node = nodes[at];
+	const int slot = ChildIndex(node, quadrant) - node.firstChild;
+	const int childCount = ChildCount(node);
+	
+	QuadTreeNode group[4];
+	QuadTreeBucket groupBuckets[4];
+	for (int i = 0; i < childCount; ++i)
+	{
+		group[i < slot ? i : i + 1] = nodes[node.firstChild + i];
+		groupBuckets[i < slot ? i : i + 1] = buckets[node.firstChild + i];
+	}
+	group[slot] = QuadTreeNode();
+	groupBuckets[slot] = QuadTreeBucket();
+	
+	int firstChild;
+	if (node.firstChild + childCount == static_cast<int>(nodes.size()))
+	{
+		nodes.Allocate(1);
+		buckets.Allocate(1);
+		firstChild = node.firstChild;
+		for (int i = slot; i <= childCount; ++i)
+		{
+			nodes[firstChild + i] = group[i];
+			buckets[firstChild + i] = groupBuckets[i];
+		}
+	}
+	else
+	{
+		firstChild = static_cast<int>(nodes.Append(group, childCount + 1));
+		buckets.Append(groupBuckets, childCount + 1);
+		quadTree.garbageNodes += childCount;
+	}
+	nodes[at].firstChild = firstChild;
+	nodes[at].childMask = node.childMask | (1 << quadrant);
+	return firstChild + slot;
+}
+
+/**
+ * System for tidying the child of a node in the given quadrant after an item was removed below it
+ * An empty leaf child is dropped, and when all children are leaves that fit into the bucket of the node
+ * together with its own items, they are merged back into it. Merging waits until half the leaf capacity
+ * so that a bucket near the limit does not split and merge on every change.
+ */
+static void CollapseChildSystem(QuadTree& quadTree, const int at, const int quadrant)
+{
+	auto& nodes = quadTree.nodes;
+	auto& buckets = quadTree.buckets;
+	{
+		const QuadTreeNode& node = nodes[at];
+		const int child = ChildIndex(node, quadrant);
+		if (nodes[child].firstChild < 0 && buckets[child].asteroidCount == 0)
+		{
+			quadTree.garbageNodes += 1;
+			quadTree.garbageEntries += buckets[child].asteroidCapacity;
+			const int groupEnd = node.firstChild + ChildCount(node);
+			for (int i = child; i + 1 < groupEnd; ++i)
+			{
+				nodes[i] = nodes[i + 1];
+				buckets[i] = buckets[i + 1];
+			}
+			nodes[at].childMask &= ~(1 << quadrant);
+			if (nodes[at].childMask == 0)
+			{
+				nodes[at].firstChild = -1;
+				return;
+			}
+		}
+	}
+	
+	const QuadTreeNode node = nodes[at];
+	unsigned int total = buckets[at].asteroidCount;
+	int child = node.firstChild;
+	for (unsigned int mask = node.childMask; mask != 0; mask &= mask - 1, ++child)
+	{
+		if (nodes[child].firstChild >= 0)
+		{
+			return;
+		}
+		total += buckets[child].asteroidCount;
+	}
+	if (total > quadTree.leafCapacity / 2)
+	{
+		return;
+	}
+	
+	child = node.firstChild;
+	for (unsigned int mask = node.childMask; mask != 0; mask &= mask - 1, ++child)
+	{
+		const QuadTreeBucket leaf = buckets[child];
+		for (unsigned int i = 0; i < leaf.asteroidCount; ++i)
+		{
+			AddToBucketSystem(quadTree, at, quadTree.entries.at(leaf.firstAsteroid + i));
+		}
+		quadTree.garbageNodes += 1;
+		quadTree.garbageEntries += leaf.asteroidCapacity;
+	}
+	nodes[at].firstChild = -1;
+	nodes[at].childMask = 0;
+}
+
+/**
+ * Recursive part of RemoveAsteroidSystem
+ * Follows the quadrants holding (x,z) down to the node owning the slot and tidies the path on the way back.
+ * @param cell square of the node at
+ * @param anyChild look in every child instead, for items whose centre no longer leads to them
+ * @return true if the slot was found and removed
+ */
+static bool RemoveEntryNodeSystem(QuadTree& quadTree, const int at, const QuadTreeCell& cell, const unsigned int slot,
+	const float x, const float z, const bool anyChild)
+{
+	const QuadTreeNode node = quadTree.nodes[at];
+	const QuadTreeBucket& bucket = quadTree.buckets[at];
+	if (slot >= bucket.firstAsteroid && slot < bucket.firstAsteroid + bucket.asteroidCount)
+	{
+		RemoveFromBucketSystem(quadTree, at, slot);
+		return true;
+	}
+	if (node.firstChild < 0)
+	{
+		return false;
+	}
+	
+	if (!anyChild)
+	{
+		const int quadrant = QuadrantOf(cell, x, z);
+		if ((node.childMask & (1 << quadrant)) == 0 ||
+			!RemoveEntryNodeSystem(quadTree, ChildIndex(node, quadrant), ChildCell(cell, quadrant), slot, x, z, false))
+		{
+			return false;
+		}
+		CollapseChildSystem(quadTree, at, quadrant);
+		return true;
+	}
+	
+	int child = node.firstChild;
+	for (int quadrant = 0; quadrant < 4; ++quadrant)
+	{
+		if (node.childMask & (1 << quadrant))
+		{
+			if (RemoveEntryNodeSystem(quadTree, child++, ChildCell(cell, quadrant), slot, x, z, true))
+			{
+				CollapseChildSystem(quadTree, at, quadrant);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/**
+ * System for finding the node an asteroid would be inserted into
+ * Discs go down to the child holding their centre until they reach a leaf or have to stay in a node, see DiscStaysInNode.
+ * @param missingQuadrant output, the quadrant of the returned node the disc belongs in if that child does not exist, else -1
+ * @param cell output, the square of the returned node
+ */
+static int InsertionNodeSystem(const QuadTree& quadTree, const Location& loc, int& missingQuadrant /*OUT*/,
+	QuadTreeCell& cell /*OUT*/)
+{
+	const float looseMargin = LooseMargin(quadTree);
+	int at = 0;
+	missingQuadrant = -1;
+	cell = quadTree.root;
+	for (;;)
+	{
+		const QuadTreeNode& node = quadTree.nodes[at];
+		const float halfSize = cell.size / 2.f;
+		if (node.firstChild < 0 || DiscStaysInNode(loc, cell.SWCornerX + halfSize, cell.SWCornerZ - halfSize, looseMargin * halfSize))
+		{
+			return at;
+		}
+		const int quadrant = QuadrantOf(cell, loc.x, loc.z);
+		if ((node.childMask & (1 << quadrant)) == 0)
+		{
+			missingQuadrant = quadrant;
+			return at;
+		}
+		at = ChildIndex(node, quadrant);
+		cell = ChildCell(cell, quadrant);
+	}
+}
+
+// Location of an asteroid as the tree stores it
+static Location AsteroidLocation(const QuadTree& quadTree, const unsigned int index)
+{
+	const auto& asteroids = quadTree.arrayAsteroids;
+	return { asteroids.x[index], asteroids.y[index], asteroids.z[index], asteroids.rds[index], index };
+}
+
+// Grows QuadTree::boundsMargin to cover how far the disc sticks out of the root square
+static void CoverRootOverhangSystem(QuadTree& quadTree, const Location& loc)
+{
+	quadTree.boundsMargin = glm::max(quadTree.boundsMargin, DiscOverhang(quadTree.root, loc.x, loc.z, loc.rds));
+}
+
+/**
+ * System for adding asteroid index of QuadTree::arrayAsteroids to the tree
+ * A leaf going over capacity is split right away.
+ * @return false if the asteroid has no radius or is already stored
+ */
+static bool InsertAsteroidSystem(QuadTree& quadTree, const unsigned int index)
+{
+	if (quadTree.nodes.empty() || quadTree.arrayAsteroids.rds[index] <= 0.f)
+	{
+		return false;
+	}
+	auto& entrySlots = quadTree.entrySlots;
+	if (entrySlots.size() <= index)
+	{
+		entrySlots.resize(index + 1, QUADTREE_NO_ENTRY);
+	}
+	if (entrySlots[index] != QUADTREE_NO_ENTRY)
+	{
+		return false;
+	}
+	
+	const Location loc = AsteroidLocation(quadTree, index);
+	CoverRootOverhangSystem(quadTree, loc);
+	
+	int missingQuadrant;
+	QuadTreeCell cell;
+	int at = InsertionNodeSystem(quadTree, loc, missingQuadrant, cell);
+	if (missingQuadrant >= 0)
+	{
+		at = AddChildSystem(quadTree, at, missingQuadrant);
+		cell = ChildCell(cell, missingQuadrant);
+	}
+	AddToBucketSystem(quadTree, at, loc);
+	if (quadTree.nodes[at].firstChild < 0)
+	{
+		SplitLeafSystem(quadTree, at, cell);
+	}
+	return true;
+}
+
+/**
+ * System for taking asteroid index out of the tree, emptied and underfull children on its path are merged away
+ * @return false if the asteroid was not stored
+ */
+static bool RemoveAsteroidSystem(QuadTree& quadTree, const unsigned int index)
+{
+	if (quadTree.nodes.empty() || index >= quadTree.entrySlots.size() || quadTree.entrySlots[index] == QUADTREE_NO_ENTRY)
+	{
+		return false;
+	}
+	
+	// the stored centre leads to the node, unless rounding at a split line sends it the other way
+	const unsigned int slot = quadTree.entrySlots[index];
+	const float x = quadTree.entries.x[slot];
+	const float z = quadTree.entries.z[slot];
+	return RemoveEntryNodeSystem(quadTree, 0, quadTree.root, slot, x, z, false) ||
+		RemoveEntryNodeSystem(quadTree, 0, quadTree.root, slot, x, z, true);
+}
+
+/**
+ * True if a loose tree stores both positions of a disc with the given radius in the same node.
+ * The radius alone fixes the deepest level the disc may go down to, two centres in the same square
+ * of that level follow the same path and end in the same node. No node is visited.
+ */
+static bool SameLooseNode(const QuadTree& quadTree, const float rds, const float x1, const float z1, const float x2, const float z2)
+{
+	const float looseMargin = LooseMargin(quadTree);
+	const QuadTreeCell& root = quadTree.root;
+	if (looseMargin == 0.f)
+	{
+		return false;
+	}
+	
+	// no node is smaller than minChildSize, so the search can stop there as well
+	const float minChildSize = MakeSplitPolicy(quadTree).minChildSize;
+	float size = root.size;
+	while (size / 2.f >= minChildSize && rds <= looseMargin * size / 2.f)
+	{
+		size /= 2.f;
+	}
+	return floor((x1 - root.SWCornerX) / size) == floor((x2 - root.SWCornerX) / size) &&
+		floor((root.SWCornerZ - z1) / size) == floor((root.SWCornerZ - z2) / size);
+}
+
+/**
+ * System for moving asteroid index to its current place in QuadTree::arrayAsteroids
+ * If the asteroid still belongs in the node that stores it, only its entry is rewritten. In a loose tree
+ * that is found without walking the tree as long as the radius and the square of its level do not change.
+ */
+static void UpdateAsteroidSystem(QuadTree& quadTree, const unsigned int index)
+{
+	if (quadTree.nodes.empty() || index >= quadTree.entrySlots.size() || quadTree.entrySlots[index] == QUADTREE_NO_ENTRY)
+	{
+		InsertAsteroidSystem(quadTree, index);
+		return;
+	}
+	
+	const Location loc = AsteroidLocation(quadTree, index);
+	if (loc.rds > 0.f)
+	{
+		const unsigned int slot = quadTree.entrySlots[index];
+		const auto& entries = quadTree.entries;
+		if (entries.rds[slot] == loc.rds && SameLooseNode(quadTree, loc.rds, entries.x[slot], entries.z[slot], loc.x, loc.z))
+		{
+			CoverRootOverhangSystem(quadTree, loc);
+			WriteEntry(quadTree, slot, loc);
+			return;
+		}
+		
+		int missingQuadrant;
+		QuadTreeCell cell;
+		const QuadTreeBucket& bucket = quadTree.buckets[InsertionNodeSystem(quadTree, loc, missingQuadrant, cell)];
+		if (missingQuadrant < 0 && slot >= bucket.firstAsteroid && slot < bucket.firstAsteroid + bucket.asteroidCount)
+		{
+			CoverRootOverhangSystem(quadTree, loc);
+			WriteEntry(quadTree, slot, loc);
+			return;
+		}
+	}
+	
+	RemoveAsteroidSystem(quadTree, index);
+	InsertAsteroidSystem(quadTree, index);
+}
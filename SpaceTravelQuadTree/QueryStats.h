@@ -0,0 +1,33 @@
+#pragma once
+
+// Counters of a single spatial index query.
+// The traversals take the counters as a template parameter. NoQueryStats has empty members that inline away,
+// so the regular queries compile to the same code as without counting, QueryStats is passed in where the
+// counts are printed (the benchmarks and the statistics key of the app).
+
+struct QueryStats
+{
+	QueryStats(){visited = tested = accepted = 0;}
+
+	void Visit() { ++visited; }
+	void Test(const unsigned int count) { tested += count; }
+	void Accept() { ++accepted; }
+
+	void Add(const QueryStats& other)
+	{
+		visited += other.visited;
+		tested += other.tested;
+		accepted += other.accepted;
+	}
+
+	unsigned int visited; // nodes whose bounds were tested against the query
+	unsigned int tested; // items tested against the query
+	unsigned int accepted; // items the query reported
+};
+
+struct NoQueryStats
+{
+	void Visit() {}
+	void Test(const unsigned int) {}
+	void Accept() {}
+};
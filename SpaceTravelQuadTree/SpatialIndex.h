@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Asteroid.h"
+
+// Interface shared by the spatial indices (QuadTree, UniformGrid, KdTree, Bvh, Octree).
+// It is resolved at compile time: a backend is a struct with the overloads below, and code written against
+// it is a template on the backend type, so the queries are direct calls the compiler can inline.
+//
+//   void SpatialIndexBuildSystem(Backend& index, float x, float z, float s, const Asteroids& asteroids, unsigned int length)
+//       builds over the square with the SW corner (x,z) and side s, asteroids with rds 0 are empty slots
+//   template<typename Found> void CullAsteroidsSystem(x1, z1, x2, z2, x3, z3, x4, z4, const Backend& index, Found found)
+//       calls found(asteroid index) for the asteroids in the frustum quadrilateral, no asteroid twice
+//   void GatherAsteroidSystem(x, z, r, const Backend& index, vector<Location>& al)
+//       appends every asteroid that may touch the disc centred (x,z) with radius r
+//   const char* SpatialIndexName(const Backend& index)
+//
+// The Bvh bounds its own boxes and ignores the square it is built over.
+// The Octree implements the overloads above by seeing every cube as a vertical column, only x and z are looked at.
+// It deviates with 3D overloads of its own, which no other backend has:
+//   template<typename Found> void CullAsteroidsSystem(const FrustumPlanes& planes, const Octree& index, Found found)
+//       culls against the six planes of a real view frustum instead of a quadrilateral, so asteroids above or
+//       below the view are left out
+//   void GatherAsteroidSystem(x, y, z, r, const Octree& index, vector<Location>& al)
+//       appends every asteroid that may touch the sphere centred (x,y,z) with radius r instead of a disc, so
+//       asteroids at other heights are left out
+
+// func to draw the asteroids (Bottleneck since every sphere is a separate draw call)
+extern void drawAsteroid(const unsigned int at);
+
+struct Location
+{
+	float x;
+	float y;
+	float z;
+	float rds; // radius
+	unsigned int index;
+};
+
+/**
+ * System for Drawing the asteroids any spatial index finds in the frustum
+ */
+template<typename SpatialIndex>
+static void DrawAsteroidsSystem(const float& x1, const float& z1, const float& x2, const float& z2,
+					  const float& x3, const float& z3, const float& x4, const float& z4, const SpatialIndex& index)
+{
+	CullAsteroidsSystem(x1, z1, x2, z2, x3, z3, x4, z4, index, [](const unsigned int at){ drawAsteroid(at); });
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Number of tasks of one batch that have not finished yet, TaskPool::Wait blocks until it reaches 0
+struct TaskGroup
+{
+	TaskGroup(){pending = 0;}
+	atomic<int> pending;
+};
+
+/**
+ * Work-stealing thread pool.
+ * Every thread owns a queue: new tasks are pushed to and popped from the back of the queue of the
+ * thread that spawned them, idle threads steal from the front of the other queues.
+ * The thread that creates the pool owns queue 0 and executes tasks as well while it waits.
+ * Workers without work sleep until a task is queued, so a pool can be kept alive between batches.
+ */
+class TaskPool
+{
+public:
+	explicit TaskPool(const unsigned int threadCount = thread::hardware_concurrency())
+	{
+		stopping = false;
+		queued = 0;
+		const unsigned int queueCount = threadCount > 0 ? threadCount : 1;
+		for (unsigned int i = 0; i < queueCount; ++i)
+		{
+			queues.emplace_back(new TaskQueue());
+		}
+		for (unsigned int i = 1; i < queueCount; ++i)
+		{
+			workers.emplace_back([this, i]{ WorkerLoop(i); });
+		}
+	}
+	
+	~TaskPool()
+	{
+		{
+			lock_guard<mutex> guard(sleepLock);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+	}
+	
+	TaskPool(const TaskPool&) = delete;
+	TaskPool& operator=(const TaskPool&) = delete;
+	
+	// Queue the task on the calling thread, it may be stolen by any other thread
+	void Run(TaskGroup& group, function<void()> task)
+	{
+		++group.pending;
+		{
+			TaskQueue& queue = *queues[ThisThreadQueue()];
+			lock_guard<mutex> guard(queue.lock);
+			queue.tasks.emplace_back([&group, task]{ task(); --group.pending; });
+		}
+		// counted under the sleep lock so a worker about to sleep cannot miss it
+		{
+			lock_guard<mutex> guard(sleepLock);
+			++queued;
+		}
+		wake.notify_one();
+	}
+	
+	// Execute queued tasks until every task of the group has finished
+	void Wait(TaskGroup& group)
+	{
+		const size_t at = ThisThreadQueue();
+		while (group.pending > 0)
+		{
+			if (!RunOneTask(at))
+			{
+				this_thread::yield();
+			}
+		}
+	}
+	
+	size_t ThreadCount() const { return queues.size(); }
+	
+private:
+	struct TaskQueue
+	{
+		mutex lock;
+		deque<function<void()>> tasks;
+	};
+	
+	// index of the queue owned by the calling thread, threads outside of the pool use queue 0
+	static size_t& ThisThreadQueue()
+	{
+		static thread_local size_t queue = 0;
+		return queue;
+	}
+	
+	bool RunOneTask(const size_t at)
+	{
+		function<void()> task;
+		{
+			TaskQueue& own = *queues[at];
+			lock_guard<mutex> guard(own.lock);
+			if (!own.tasks.empty())
+			{
+				task = move(own.tasks.back());
+				own.tasks.pop_back();
+			}
+		}
+		
+		// nothing left locally, steal the oldest (largest) task of another thread
+		for (size_t i = 1; !task && i < queues.size(); ++i)
+		{
+			TaskQueue& victim = *queues[(at + i) % queues.size()];
+			lock_guard<mutex> guard(victim.lock);
+			if (!victim.tasks.empty())
+			{
+				task = move(victim.tasks.front());
+				victim.tasks.pop_front();
+			}
+		}
+		
+		if (!task)
+		{
+			return false;
+		}
+		--queued;
+		task();
+		return true;
+	}
+	
+	void WorkerLoop(const size_t at)
+	{
+		ThisThreadQueue() = at;
+		while (!stopping)
+		{
+			if (!RunOneTask(at))
+			{
+				unique_lock<mutex> sleep(sleepLock);
+				wake.wait(sleep, [this]{ return stopping || queued > 0; });
+			}
+		}
+	}
+	
+	vector<unique_ptr<TaskQueue>> queues;
+	vector<thread> workers;
+	atomic<bool> stopping;
+	atomic<int> queued; // tasks in all the queues, may dip below 0 while a stolen task is still being counted
+	mutex sleepLock;
+	condition_variable wake;
+};
+
+// Number of chunks ParallelFor splits count items into, each of at least minChunk items and at most one per thread
+static size_t ParallelChunkCount(const TaskPool& pool, const size_t count, const size_t minChunk)
+{
+	const size_t chunks = count / (minChunk > 0 ? minChunk : 1);
+	return chunks < 1 ? 1 : (chunks < pool.ThreadCount() ? chunks : pool.ThreadCount());
+}
+
+/**
+ * Runs body(chunk, begin, end) for every one of chunks even slices of [0, count) on the pool and waits for them
+ * The calling thread takes the first slice itself, a single chunk never touches the queues.
+ */
+template<typename Body>
+static void ParallelFor(TaskPool& pool, const size_t count, const size_t chunks, const Body& body)
+{
+	if (chunks <= 1)
+	{
+		body(size_t(0), size_t(0), count);
+		return;
+	}
+	TaskGroup group;
+	for (size_t chunk = 1; chunk < chunks; ++chunk)
+	{
+		pool.Run(group, [&body, chunk, count, chunks]{ body(chunk, count * chunk / chunks, count * (chunk + 1) / chunks); });
+	}
+	body(size_t(0), size_t(0), count / chunks);
+	pool.Wait(group);
+}
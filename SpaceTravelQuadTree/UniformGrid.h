@@ -0,0 +1,201 @@
+#pragma once
+
+#include <vector>
+#include "QuadTree.h"
+
+// Flat grid over the root square, the alternative to the QuadTree for evenly spread asteroids.
+// Every asteroid is stored in the cell holding its centre and the cells are stored row by row, so a run
+// of cells in one row is one contiguous range of entries. The queries find those runs with cell arithmetic
+// and scan them with the SIMD bucket scans, there is no descent at all.
+
+using namespace std;
+
+constexpr auto UNIFORM_GRID_CELL_SIZE = 30.f; // spacing of the asteroid lattice in setupAsteroidField
+
+struct UniformGrid
+{
+	UniformGrid(){SWCornerX = SWCornerZ = 0.f; cellSize = 1.f; columns = rows = 0; boundsMargin = 0.f;}
+	
+	float SWCornerX, SWCornerZ; // SW corner of the covered square, rows count north (decreasing z) from there
+	float cellSize;
+	int columns, rows;
+	std::vector<unsigned int> cellStart; // cell row * columns + column owns the entries [cellStart[cell], cellStart[cell + 1])
+	QuadTreeEntries entries; // asteroids in cell order
+	float boundsMargin; // largest radius, how far a disc may stick out of its cell
+};
+
+// Column of the cell holding x, positions outside the grid go to the border cells
+static int GridColumn(const UniformGrid& grid, const float x)
+{
+	const float column = floor((x - grid.SWCornerX) / grid.cellSize);
+	return static_cast<int>(glm::clamp(column, 0.f, static_cast<float>(grid.columns - 1)));
+}
+
+// Row of the cell holding z, positions outside the grid go to the border cells
+static int GridRow(const UniformGrid& grid, const float z)
+{
+	const float row = floor((grid.SWCornerZ - z) / grid.cellSize);
+	return static_cast<int>(glm::clamp(row, 0.f, static_cast<float>(grid.rows - 1)));
+}
+
+/**
+ * System for building the grid over the square with the SW corner (x,z) and side s
+ * A counting sort by cell, two passes over the asteroids.
+ */
+static void UniformGridInitializeSystem(const float x, const float z, const float s, const float cellSize,
+	const Asteroids& asteroids, const unsigned int length, UniformGrid& grid)
+{
+	grid.SWCornerX = x;
+	grid.SWCornerZ = z;
+	grid.cellSize = cellSize;
+	grid.columns = grid.rows = glm::max(1, static_cast<int>(ceil(s / cellSize)));
+	grid.boundsMargin = 0.f;
+	
+	auto& cellStart = grid.cellStart;
+	cellStart.assign(grid.columns * grid.rows + 1, 0u);
+	vector<unsigned int> cells(length);
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		if (asteroids.rds[i] > 0.f)
+		{
+			cells[i] = GridRow(grid, asteroids.z[i]) * grid.columns + GridColumn(grid, asteroids.x[i]);
+			++cellStart[cells[i] + 1];
+			grid.boundsMargin = glm::max(grid.boundsMargin, asteroids.rds[i]);
+		}
+	}
+	for (size_t cell = 1; cell < cellStart.size(); ++cell)
+	{
+		cellStart[cell] += cellStart[cell - 1];
+	}
+	
+	const unsigned int count = cellStart.back();
+	auto& entries = grid.entries;
+	entries.x.assign(count + SIMD_WIDTH - 1, 0.f);
+	entries.y.assign(count + SIMD_WIDTH - 1, 0.f);
+	entries.z.assign(count + SIMD_WIDTH - 1, 0.f);
+	entries.rds.assign(count + SIMD_WIDTH - 1, 0.f);
+	entries.index.resize(count);
+	
+	// cellStart[cell] is used as the insertion cursor and ends up at the start of the next cell
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		if (asteroids.rds[i] > 0.f)
+		{
+			const unsigned int slot = cellStart[cells[i]]++;
+			entries.x[slot] = asteroids.x[i];
+			entries.y[slot] = asteroids.y[i];
+			entries.z[slot] = asteroids.z[i];
+			entries.rds[slot] = asteroids.rds[i];
+			entries.index[slot] = i;
+		}
+	}
+	for (size_t cell = cellStart.size() - 1; cell > 0; --cell)
+	{
+		cellStart[cell] = cellStart[cell - 1];
+	}
+	cellStart[0] = 0;
+}
+
+/**
+ * System that detects which asteroids should be considered for collision checks, see the QuadTree version
+ */
+static void GatherAsteroidSystem(const float& x, const float& z, const float& r, const UniformGrid& grid, vector<Location>& al /*OUT*/)
+{
+	const auto& entries = grid.entries;
+	if (entries.size() == 0)
+	{
+		return;
+	}
+	
+	const float reach = r + grid.boundsMargin;
+	const int firstColumn = GridColumn(grid, x - reach);
+	const int lastColumn = GridColumn(grid, x + reach);
+	for (int row = GridRow(grid, z + reach); row <= GridRow(grid, z - reach); ++row)
+	{
+		const unsigned int first = grid.cellStart[row * grid.columns + firstColumn];
+		const unsigned int end = grid.cellStart[row * grid.columns + lastColumn + 1];
+		ScanDiscsNearPoint(&entries.x[first], &entries.z[first], &entries.rds[first], end - first, x, z, r,
+			[&](const unsigned int i){ al.push_back(entries.at(first + i)); });
+	}
+}
+
+/**
+ * System for culling asteroids based on the grid, found(index) is called for every asteroid in the frustum
+ * Every row of cells touched by the frustum quadrilateral is clipped against it and the cells between
+ * the clipped x extent, grown by the margin, are scanned as one range.
+ */
+template<typename Found>
+static void CullAsteroidsSystem(const float& x1, const float& z1, const float& x2, const float& z2,
+					  const float& x3, const float& z3, const float& x4, const float& z4, const UniformGrid& grid, Found found)
+{
+	const auto& entries = grid.entries;
+	if (entries.size() == 0)
+	{
+		return;
+	}
+	
+	const FrustumEdges edges = MakeFrustumEdges(x1, z1, x2, z2, x3, z3, x4, z4);
+	const float xs[4] = { x1, x2, x3, x4 };
+	const float zs[4] = { z1, z2, z3, z4 };
+	const float margin = grid.boundsMargin;
+	
+	const float southZ = glm::max(glm::max(z1, z2), glm::max(z3, z4));
+	const float northZ = glm::min(glm::min(z1, z2), glm::min(z3, z4));
+	const int lastRow = GridRow(grid, northZ - margin);
+	for (int row = GridRow(grid, southZ + margin); row <= lastRow; ++row)
+	{
+		// z band of the centres stored in the row, grown by the margin, the border rows also hold everything beyond
+		const float bandSouth = row == 0 ? southZ : grid.SWCornerZ - row * grid.cellSize + margin;
+		const float bandNorth = row == grid.rows - 1 ? northZ : grid.SWCornerZ - (row + 1) * grid.cellSize - margin;
+	
+		float minX = 0.f, maxX = -1.f;
+		bool touched = false;
+		for (int e = 0; e < 4; ++e)
+		{
+			const int next = (e + 1) & 3;
+			const float dz = zs[next] - zs[e];
+			float t0 = 0.f, t1 = 1.f;
+			if (dz != 0.f)
+			{
+				const float ta = (bandNorth - zs[e]) / dz;
+				const float tb = (bandSouth - zs[e]) / dz;
+				t0 = glm::max(t0, glm::min(ta, tb));
+				t1 = glm::min(t1, glm::max(ta, tb));
+			}
+			else if (zs[e] < bandNorth || zs[e] > bandSouth)
+			{
+				continue;
+			}
+			if (t0 > t1)
+			{
+				continue;
+			}
+	
+			const float dx = xs[next] - xs[e];
+			const float ends[2] = { xs[e] + t0 * dx, xs[e] + t1 * dx };
+			for (const float end : ends)
+			{
+				minX = touched ? glm::min(minX, end) : end;
+				maxX = touched ? glm::max(maxX, end) : end;
+				touched = true;
+			}
+		}
+		if (!touched)
+		{
+			continue;
+		}
+	
+		const unsigned int first = grid.cellStart[row * grid.columns + GridColumn(grid, minX - margin)];
+		const unsigned int end = grid.cellStart[row * grid.columns + GridColumn(grid, maxX + margin) + 1];
+		ScanDiscsInFrustum(&entries.x[first], &entries.z[first], &entries.rds[first], end - first, edges,
+			[&](const unsigned int i){ found(entries.index[first + i]); });
+	}
+}
+
+static void SpatialIndexBuildSystem(UniformGrid& grid, const float x, const float z, const float s,
+	const Asteroids& asteroids, const unsigned int length)
+{
+	UniformGridInitializeSystem(x, z, s, UNIFORM_GRID_CELL_SIZE, asteroids, length, grid);
+}
+
+static const char* SpatialIndexName(const UniformGrid&) { return "grid"; }
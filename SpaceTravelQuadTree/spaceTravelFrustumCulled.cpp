@@ -13,19 +13,40 @@
 // Press the left/right arrow keys to turn the craft.
 // Press the up/down arrow keys to move the craft.
 // Press space to toggle between frustum culling enabled and disabled.
+// Press R to generate a new asteroid field.
+// Press L to switch between the strict and the loose QuadTree.
+// Press G to switch between the QuadTree, the uniform grid, the k-d tree, the BVH and the octree.
+// Press V to switch between the flat field and one that fills a volume, the octree culls in 3D.
+// Press I to print the QuadTree statistics and the work of the craft's cull and collision query.
+//
+// Run with -benchmark to time the QuadTree headless instead of opening the window.
+// The field size comes from -rows N, -columns N and -fill PERCENT, or from -field FILE holding
+// "rows N", "columns N" and "fill PERCENT" lines. The defaults are in Asteroid.h.
+// The first field and its QuadTree are saved to asteroidField.qts and mapped back in on later launches.
 // 
 // Sumanta Guha.
 // C/C++ version: Jessica Bayliss
 // Data Oriented Version: Dennis Slavinsky
 //////////////////////////////////////////////////////////////////////////////////////
 
+#include <chrono>
+#include <cstring>
 #include <ctime> 
+#include <fstream>
 #include <iostream>
+#include <string>
 #include <GL/glew.h>
 #include <GL/glfw3.h>
 #include <glm/glm.hpp>
 #include "Asteroid.h"
+#include "Bvh.h"
+#include "KdTree.h"
+#include "Octree.h"
 #include "QuadTree.h"
+#include "QuadTreeBenchmark.h"
+#include "QuadTreeSnapshot.h"
+#include "QuadTreeStats.h"
+#include "UniformGrid.h"
 
 using namespace std;
 
@@ -43,6 +64,7 @@ static float angle = 0.0; // Angle of the spacecraft.
 static float xVal = 0, zVal = 0; // Co-ordinates of the spacecraft.
 static int isFrustumCulled = 0;
 static int isCollision = 0; // Is there collision between the spacecraft and an asteroid?
+static float fieldHeight = 0.f; // The asteroids are spread over this height around y = 0, 0 for the flat field.
 
 
 // vertex counting for where everything goes in the global array
@@ -57,16 +79,104 @@ static int line_index = cone_index + CONE_VERTEX_COUNT;
 static int sphere_index = line_index + LINE_VERTEX_COUNT;
 
 // shader stuff
-// addition of all rows/cols for asteroid vertices + spaceship vertices + line vertices  
-static glm::vec3 points[CONE_VERTEX_COUNT+LINE_VERTEX_COUNT+SPHERE_VERTEX_COUNT*ROWS*COLUMNS];
+// spaceship vertices + line vertices + one sphere, every asteroid draws the same sphere at its own position
+static glm::vec3 points[CONE_VERTEX_COUNT+LINE_VERTEX_COUNT+SPHERE_VERTEX_COUNT];
 static GLuint myShaderProgram;
 GLuint InitShader(const char* vShaderFile, const char* fShaderFile);
 static GLuint myBuffer;
 static GLuint vPosLoc;
 
 // the asteroids and quad tree from the initial program
+static AsteroidFieldSettings field = AsteroidFieldSettings(); // Size of the asteroid field, from the command line.
 static Asteroids asteroids = Asteroids(); // Global array of asteroids.
 static QuadTree asteroidsQuadTree = QuadTree(); // Global QuadTree.
+// The other spatial indices are only kept up to date while they are selected.
+static UniformGrid asteroidsGrid = UniformGrid();
+static KdTree asteroidsKdTree = KdTree();
+static Bvh asteroidsBvh = Bvh();
+static Octree asteroidsOctree = Octree();
+constexpr auto SPATIAL_INDEX_COUNT = 5;
+static int spatialIndex = 0; // Index used for culling and collisions: 0 QuadTree, 1 uniform grid, 2 k-d tree, 3 BVH, 4 octree.
+static vector<unsigned int> viewportAsteroids[2]; // Asteroids the QuadTree finds in the left and the right viewport.
+
+// Calls visit with the selected spatial index. The queries are templates on the index type,
+// so this is the only place that branches on the selection and every backend gets its own code.
+template<typename Visit>
+static void withSpatialIndex(Visit visit)
+{
+	switch (spatialIndex)
+	{
+	case 1: visit(asteroidsGrid); break;
+	case 2: visit(asteroidsKdTree); break;
+	case 3: visit(asteroidsBvh); break;
+	case 4: visit(asteroidsOctree); break;
+	default: visit(asteroidsQuadTree); break;
+	}
+}
+
+// Builds the selected spatial index over the same square as the QuadTree root.
+static void setupSpatialIndex()
+{
+	if (spatialIndex == 0)
+	{
+		return; // the QuadTree is always up to date
+	}
+	const QuadTreeCell root = asteroidsQuadTree.root;
+	withSpatialIndex([&root](auto& index)
+	{
+		SpatialIndexBuildSystem(index, root.SWCornerX, root.SWCornerZ, root.size, asteroids, asteroidsQuadTree.length);
+	});
+}
+
+// The x/z indices cull with the frustum quadrilateral, the shadow of the view frustum on the field.
+template<typename SpatialIndex>
+static void drawCulledAsteroids(const float (&quad)[8], const FrustumPlanes&, const SpatialIndex& index)
+{
+	DrawAsteroidsSystem(quad[0], quad[1], quad[2], quad[3], quad[4], quad[5], quad[6], quad[7], index);
+}
+
+// The octree culls with the 3D view frustum itself.
+static void drawCulledAsteroids(const float (&)[8], const FrustumPlanes& frustum, const Octree& octree)
+{
+	DrawAsteroidsSystem(frustum, octree);
+}
+
+// Draws the asteroids the selected spatial index finds in the view frustum.
+static void drawCulledAsteroids(const float (&quad)[8], const FrustumPlanes& frustum)
+{
+	withSpatialIndex([&](const auto& index){ drawCulledAsteroids(quad, frustum, index); });
+}
+
+// The QuadTree culls both viewports in a single walk before either is drawn, into viewportAsteroids.
+static void cullViewports(const float (&fixedQuad)[8], const float (&craftQuad)[8])
+{
+	const FrustumQuad frustums[2] = {
+		MakeFrustumQuad(fixedQuad[0], fixedQuad[1], fixedQuad[2], fixedQuad[3], fixedQuad[4], fixedQuad[5], fixedQuad[6], fixedQuad[7]),
+		MakeFrustumQuad(craftQuad[0], craftQuad[1], craftQuad[2], craftQuad[3], craftQuad[4], craftQuad[5], craftQuad[6], craftQuad[7]) };
+	CullAsteroidsSystem(frustums, 2, asteroidsQuadTree, viewportAsteroids);
+}
+
+// Draws the asteroids cullViewports found for one viewport.
+static void drawVisibleAsteroids(const vector<unsigned int>& visible)
+{
+	for (const unsigned int at : visible)
+	{
+		drawAsteroid(at);
+	}
+}
+
+// The x/z indices gather the asteroids in a vertical column around the craft.
+template<typename SpatialIndex>
+static void gatherNearCraft(const float x, const float z, const float r, const SpatialIndex& index, vector<Location>& al /*OUT*/)
+{
+	GatherAsteroidSystem(x, z, r, index, al);
+}
+
+// The octree gathers the asteroids around the craft in 3D, the craft flies at y = 0.
+static void gatherNearCraft(const float x, const float z, const float r, const Octree& octree, vector<Location>& al /*OUT*/)
+{
+	GatherAsteroidSystem(x, 0.f, z, r, octree, al);
+}
 
 // function obtained from tutorial at:
 // http://www.freemancw.com/2012/06/opengl-cone-function/
@@ -225,15 +335,19 @@ inline void resize(GLFWwindow* window, int w, int h)
 	height = h;
 }
 
-// Initialization routine.
-void setup() 
+// Creates the asteroid field and builds the QuadTree over it, no graphics calls in here.
+// With useSnapshot a saved field for the same seed is loaded instead, or the new one is saved.
+void setupAsteroidField(const unsigned int seed, const bool useSnapshot)
 {
-	int i, j;
+	unsigned int i, j;
 	float initialSize;
     // create memory for each potential asteroid
+	const unsigned int rows = field.rows;
+	const unsigned int columns = field.columns;
+	asteroids.Resize(rows * columns);
 	
     // create the quad tree for the asteroids
-	asteroidsQuadTree.length = COLUMNS*ROWS;
+	asteroidsQuadTree.length = asteroids.size();
 
     // create the line for the middle of the screen
     points[line_index].x = 0;
@@ -250,27 +364,32 @@ void setup()
 	// no need to optimize, has low impact as only 1 cone is ever created
     CreateCone(direction, apex, 10, 5, 10, cone_index);
 
-    // create where the spheres are going in the field   
-    int index = sphere_index;
-	// calculate the sphere once - reuse the data after
-	const glm::uint validSpaces = CreateSphere(SPHERE_SIZE, 0, 0, 0, index);
+    // calculate the sphere once, every asteroid draws it translated to its position
+	CreateSphere(SPHERE_SIZE, 0, 0, 0, sphere_index);
+
+	if (useSnapshot && LoadSnapshotSystem(QUADTREE_SNAPSHOT_FILE, asteroidsQuadTree, field, seed))
+	{
+		asteroids = asteroidsQuadTree.arrayAsteroids;
+		cout << "QuadTree loaded from " << QUADTREE_SNAPSHOT_FILE << ", " << asteroidsQuadTree.nodes.size() << " nodes" << endl;
+		setupSpatialIndex();
+		return;
+	}
+
+	srand(seed);
 
     // Initialize global arrayAsteroids.
     // 
-	// change -- move the if else outside of the loop
-	// change -- no need to check for COLUMN evenness every time just calculate it once and add the number if necessary, a lot less code
-	// Position the asteroids depending on if there is an even or odd number of columns
-    // so that the spacecraft faces the middle of the asteroid field.
-	const float odd = (COLUMNS % 2) ? 0 : 15.f; // changed
-	for (i = 0; i < COLUMNS; i++)
+	// Centre the rows on x = 0 for an even or odd number of rows alike,
+    // so that the spacecraft faces the middle of the asteroid field and the field stays inside the root square.
+	for (i = 0; i < columns; i++)
 	{
-		for (j = 0; j < ROWS; j++)
+		for (j = 0; j < rows; j++)
 		{
-			if (rand() % 100 < FILL_PROBABILITY)
+			if (static_cast<unsigned int>(rand() % 100) < field.fillProbability)
 			{
-				const glm::uint inn = COLUMNS * j + i;
-				asteroids.x[inn] = odd + 30.0f * (-COLUMNS / 2.f + j);
-				asteroids.y[inn] = 0.f;
+				const glm::uint inn = columns * j + i;
+				asteroids.x[inn] = 30.0f * (j - (rows - 1) / 2.f);
+				asteroids.y[inn] = fieldHeight > 0.f ? fieldHeight * ((rand() % 1001) / 1000.f - 0.5f) : 0.f;
 				asteroids.z[inn] = -40.0f - 30.0f * i;
 				asteroids.rds[inn] = 3.f;
 				
@@ -278,26 +397,40 @@ void setup()
 				asteroids.g[inn] = rand() % 256;
 				asteroids.b[inn] = rand() % 256;
 				
-				asteroids.i[inn] = index;
-				
-				glm::uint count = 0;
-				
-				while(count < validSpaces)
-				{
-					points[count + index] = points[count + sphere_index];
-					count++;
-				}
-	   			index += SPHERE_VERTEX_COUNT;
+				asteroids.i[inn] = sphere_index;
 			}
 		}
 	}
 
 	// Initialize global asteroidsQuadtree - the root square bounds the entire asteroid field.
-	if (ROWS <= COLUMNS) initialSize = (COLUMNS - 1) * 30.0f + 6.0f;
-	else initialSize = (ROWS - 1) * 30.0f + 6.0f;
+	if (rows <= columns) initialSize = (columns - 1) * 30.0f + 6.0f;
+	else initialSize = (rows - 1) * 30.0f + 6.0f;
 
 	asteroidsQuadTree.arrayAsteroids = asteroids;
+	
+	const auto buildStart = chrono::high_resolution_clock::now();
 	QuadTreeInitializeSystem(-initialSize / 2.0f, -37.f, initialSize, asteroidsQuadTree);
+	cout << "QuadTree built in "
+		<< chrono::duration<double, milli>(chrono::high_resolution_clock::now() - buildStart).count()
+		<< " ms, " << asteroidsQuadTree.nodes.size() << " nodes in "
+		<< asteroidsQuadTree.nodes.CapacityBytes() / 1024 << " KB, buckets in "
+		<< asteroidsQuadTree.buckets.CapacityBytes() / 1024 << " KB" << endl;
+	if (asteroidsQuadTree.limitedLeaves > 0)
+	{
+		cout << asteroidsQuadTree.limitedLeaves << " leaves hit the QuadTree depth/cell size limit" << endl;
+	}
+	
+	if (useSnapshot && !SaveSnapshotSystem(QUADTREE_SNAPSHOT_FILE, asteroidsQuadTree, field, seed))
+	{
+		cout << "Could not save " << QUADTREE_SNAPSHOT_FILE << endl;
+	}
+	setupSpatialIndex();
+}
+
+// Initialization routine.
+void setup() 
+{
+	setupAsteroidField(FIELD_SEED, true);
 	
 	// initialize the graphics
 	glEnable(GL_DEPTH_TEST);
@@ -351,12 +484,12 @@ int checkSpheresIntersection(float x1, float y1, float z1, float r1,
 // Collision detection is approximate as instead of the spacecraft we use a bounding sphere.
 int asteroidCraftCollision(const float& x, const float& z, const float& a)
 {
-	// Check for collision with up to 4 asteroids by using the quad tree
+	// Check for collision only with the asteroids the quad tree finds near the craft
 	vector<Location> astl;
 	
 	const float x_calc = x - 5.f * sin((PI / 180.f) * a); 
 	const float z_calc = z - 5 * cos((PI / 180.f) * a);
-	GatherAsteroidSystem(x_calc, z_calc, asteroidsQuadTree.header, astl /*OUT*/);
+	withSpatialIndex([&](const auto& index){ gatherNearCraft(x_calc, z_calc, 7.072f, index, astl /*OUT*/); });
 	if (!astl.empty())
 	{
 		for(auto &it : astl)
@@ -440,7 +573,7 @@ void lookAt(
 // https://github.com/DennisSSDev/dataOrientedSeminar/tree/OptimizedRender
 static void DrawAllAsteroidsSystem()
 {
-	for(int i = 0; i < ROWS*COLUMNS; i++)
+	for(unsigned int i = 0; i < asteroids.size(); i++)
 	{
 		if(asteroids.rds[i] > 0.f)
 		{
@@ -488,6 +621,29 @@ void drawScene(void)
     glEnableVertexAttribArray(vPosLoc);
 	glVertexAttribPointer(vPosLoc, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
+	// Frustum quadrilaterals of both viewports: the fixed frustum with apex at the origin and the frustum
+	// "carried" by the spacecraft with apex at its tip and oriented with its axis along the spacecraft's axis.
+	const float fixedQuad[8] = { -5.f, -5.f, -250.f, -250.f, 250.f, -250.f, 5.f, -5.f };
+	const float sinAngleDeg = sin((PI / 180.f) * (45.f + angle));
+	const float zCosAngleDeg = cos((PI / 180.f) * (45.f + angle));
+	const float xSinAngleDeg = sin((PI / 180.f) * (45.f - angle));
+	const float cosAngleDeg = cos((PI / 180.f) * (45.f - angle));
+	const float craftQuad[8] = { xVal - 7.072f * sinAngleDeg,
+		zVal - 7.072f * zCosAngleDeg,
+		xVal - 353.6f * sinAngleDeg,
+		zVal - 353.6f * zCosAngleDeg,
+		xVal + 353.6f * xSinAngleDeg,
+		zVal - 353.6f * cosAngleDeg,
+		xVal + 7.072f * xSinAngleDeg,
+		zVal - 7.072f * cosAngleDeg };
+	
+	// Only the QuadTree has a multi-frustum cull, with the other indices each viewport culls when it is drawn.
+	const bool cullOnce = isFrustumCulled && spatialIndex == 0;
+	if (cullOnce)
+	{
+		cullViewports(fixedQuad, craftQuad);
+	}
+
    // Begin left viewport.
    glViewport (0, 0, width / 2.0,  height); 
    glLoadIdentity();
@@ -500,11 +656,17 @@ void drawScene(void)
 	{
    		DrawAllAsteroidsSystem();
 	}
+	else if (cullOnce)
+	{
+		drawVisibleAsteroids(viewportAsteroids[0]);
+	}
 	else
 	{
 		// Draw only asteroids in leaf squares of the QuadTree that intersect the fixed frustum
 		// with apex at the origin.
-		DrawAsteroidsSystem(-5.f, -5.f, -250.f, -250.f, 250.f, -250.f, 5.f, -5.f, asteroidsQuadTree.header);
+		const FrustumPlanes frustum = MakeFrustumPlanes(glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f), glm::vec3(0.f, 1.f, 0.f),
+			VIEW_TAN_HALF_ANGLE, VIEW_NEAR, VIEW_FAR);
+		drawCulledAsteroids(fixedQuad, frustum);
 	}
 
 	// off is white spaceship and on it red
@@ -559,29 +721,41 @@ void drawScene(void)
    {
 	   DrawAllAsteroidsSystem();
    }
+   else if (cullOnce)
+   {
+	   drawVisibleAsteroids(viewportAsteroids[1]);
+   }
    else
    {
 	   // Draw only asteroids in leaf squares of the quadtree that intersect the frustum
-	   // "carried" by the spacecraft with apex at its tip and oriented with its axis
-	   // along the spacecraft's axis.
-	   
-		const float sinAngleDeg = sin((PI / 180.f) * (45.f + angle));
-   		const float zCosAngleDeg = cos((PI / 180.f) * (45.f + angle));
-   		const float xSinAngleDeg = sin((PI / 180.f) * (45.f - angle));
-   		const float cosAngleDeg = cos((PI / 180.f) * (45.f - angle));
-
-   		DrawAsteroidsSystem(xVal - 7.072f * sinAngleDeg,
-		   zVal - 7.072f * zCosAngleDeg,
-		   xVal - 353.6f * sinAngleDeg,
-		   zVal - 353.6f * zCosAngleDeg,
-		   xVal + 353.6f * xSinAngleDeg,
-		   zVal - 353.6f * cosAngleDeg,
-		   xVal + 7.072f * xSinAngleDeg,
-		   zVal - 7.072f * cosAngleDeg, asteroidsQuadTree.header);
+	   // "carried" by the spacecraft.
+		const FrustumPlanes frustum = MakeFrustumPlanes(glm::vec3(xVal - 10 * sinDegree, 0.f, zVal - 10 * cosDegree),
+			glm::vec3(-sinDegree, 0.f, -cosDegree), glm::vec3(0.f, 1.f, 0.f), VIEW_TAN_HALF_ANGLE, VIEW_NEAR, VIEW_FAR);
+		drawCulledAsteroids(craftQuad, frustum);
    }
    // End right viewport.
 }
 
+// Prints the shape of the QuadTree and how much work the cull of the right viewport and the collision query do right now.
+static void printQuadTreeStats()
+{
+	cout << "QuadTree statistics:" << endl;
+	PrintQuadTreeStatsSystem(QuadTreeStatsSystem(asteroidsQuadTree));
+	
+	QueryStats cull;
+	float quad[8];
+	CraftFrustum(xVal, zVal, angle, quad);
+	CullAsteroidsSystem(quad[0], quad[1], quad[2], quad[3], quad[4], quad[5], quad[6], quad[7], asteroidsQuadTree,
+		[](const unsigned int){}, cull);
+	PrintQueryStatsSystem("craft cull", cull, 1);
+	
+	QueryStats gather;
+	vector<Location> al;
+	GatherAsteroidSystem(xVal - 5.f * sin((PI / 180.f) * angle), zVal - 5.f * cos((PI / 180.f) * angle), 7.072f,
+		asteroidsQuadTree, al, gather);
+	PrintQueryStatsSystem("collision query", gather, 1);
+}
+
 void keyInput(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
 	float tempxVal = xVal, tempzVal = zVal, tempAngle = angle;
@@ -596,6 +770,42 @@ void keyInput(GLFWwindow* window, int key, int scancode, int action, int mods)
 			  isFrustumCulled = 1 - isFrustumCulled;
 		}
 		break;
+	  case GLFW_KEY_R:
+		// new random field, the QuadTree reuses its memory for the rebuild
+		if (action == GLFW_RELEASE) {
+			  setupAsteroidField(static_cast<unsigned int>(time(0)), false);
+		}
+		break;
+	  case GLFW_KEY_L:
+		// same field, the tree is rebuilt with the other looseness
+		if (action == GLFW_RELEASE) {
+			  const QuadTreeCell root = asteroidsQuadTree.root;
+			  asteroidsQuadTree.looseness = asteroidsQuadTree.looseness > 1.f ? 1.f : 2.f;
+			  QuadTreeInitializeSystem(root.SWCornerX, root.SWCornerZ, root.size, asteroidsQuadTree);
+			  cout << "QuadTree looseness " << asteroidsQuadTree.looseness << endl;
+		}
+		break;
+	  case GLFW_KEY_G:
+		// the next index is built from the current field when it gets selected
+		if (action == GLFW_RELEASE) {
+			  spatialIndex = (spatialIndex + 1) % SPATIAL_INDEX_COUNT;
+			  setupSpatialIndex();
+			  withSpatialIndex([](const auto& index){ cout << "Spatial index: " << SpatialIndexName(index) << endl; });
+		}
+		break;
+	  case GLFW_KEY_V:
+		// new random field, spread over a volume or flat again
+		if (action == GLFW_RELEASE) {
+			  fieldHeight = fieldHeight > 0.f ? 0.f : FIELD_VOLUME_HEIGHT;
+			  setupAsteroidField(static_cast<unsigned int>(time(0)), false);
+			  cout << (fieldHeight > 0.f ? "Volume" : "Flat") << " asteroid field" << endl;
+		}
+		break;
+	  case GLFW_KEY_I:
+		if (action == GLFW_RELEASE) {
+			  printQuadTreeStats();
+		}
+		break;
 	  case GLFW_KEY_LEFT: 
 		tempAngle = angle + 5.f;
 		break;
@@ -639,13 +849,100 @@ inline void printInteraction(void)
    cout << "Interaction:" << endl;
    cout << "Press the left/right arrow keys to turn the craft." << endl
         << "Press the up/down arrow keys to move the craft." << endl
-		<< "Press space to toggle between frustum culling enabled and disabled." << endl;
+		<< "Press space to toggle between frustum culling enabled and disabled." << endl
+		<< "Press R to generate a new asteroid field." << endl
+		<< "Press L to switch between the strict and the loose QuadTree." << endl
+		<< "Press G to switch between the QuadTree, the uniform grid, the k-d tree, the BVH and the octree." << endl
+		<< "Press V to switch between the flat field and one that fills a volume." << endl
+		<< "Press I to print the QuadTree statistics." << endl;
+}
+
+// Sets one field setting, the names are the ones of the command line without the dash.
+static bool setFieldSetting(const string& name, const unsigned int value)
+{
+	if (name == "rows") field.rows = value;
+	else if (name == "columns") field.columns = value;
+	else if (name == "fill") field.fillProbability = value;
+	else return false;
+	return true;
+}
+
+// Reads a field file, one "name value" setting per line.
+static bool readFieldFile(const char* path)
+{
+	ifstream file(path);
+	if (!file)
+	{
+		cout << "Could not open field file " << path << endl;
+		return false;
+	}
+	string name;
+	unsigned int value;
+	while (file >> name >> value)
+	{
+		if (!setFieldSetting(name, value))
+		{
+			cout << "Unknown field setting " << name << " in " << path << endl;
+			return false;
+		}
+	}
+	return file.eof();
+}
+
+// Reads the field settings and -benchmark from the command line.
+static bool parseCommandLine(int argc, char **argv, bool& benchmark /*OUT*/)
+{
+	benchmark = false;
+	for (int arg = 1; arg < argc; ++arg)
+	{
+		if (strcmp(argv[arg], "-benchmark") == 0)
+		{
+			benchmark = true;
+		}
+		else if (strcmp(argv[arg], "-field") == 0 && arg + 1 < argc)
+		{
+			if (!readFieldFile(argv[++arg]))
+			{
+				return false;
+			}
+		}
+		else if (argv[arg][0] != '-' || arg + 1 >= argc || !setFieldSetting(argv[arg] + 1, strtoul(argv[arg + 1], nullptr, 10)))
+		{
+			cout << "Unknown argument " << argv[arg] << endl;
+			return false;
+		}
+		else
+		{
+			++arg;
+		}
+	}
+	
+	// QuadTreeNode::firstAsteroid indexes the entries with 27 bits
+	const unsigned long long slots = static_cast<unsigned long long>(field.rows) * field.columns;
+	if (slots == 0 || slots > (1ull << 27) || field.fillProbability > 100)
+	{
+		cout << "The field needs 1 to " << (1u << 27) << " slots and a fill of at most 100 percent" << endl;
+		return false;
+	}
+	return true;
 }
 
 // Main routine.
 int main(int argc, char **argv) 
 {
-	srand((unsigned)time(0));
+	bool benchmark;
+	if (!parseCommandLine(argc, argv, benchmark))
+	{
+		return -1;
+	}
+	
+	if (benchmark)
+	{
+		setupAsteroidField(FIELD_SEED, false);
+		RunBenchmarksSystem(asteroidsQuadTree);
+		return 0;
+	}
+	
 	printInteraction();
 
 	// set up the window